@@ -6,9 +6,30 @@
 #include <functional>
 #include <x86intrin.h>
 #include <sys/time.h>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <map>
 
 #include "buffer.hpp"
 #include "cbuffer.hpp"
+#include "cqueue.hpp"
+#include "cpool.hpp"
+#include "clossy.hpp"
+#include "cwindow.hpp"
+#include "ccolumn.hpp"
+#include "cjournal.hpp"
+#include "cpipeline.hpp"
 
 #define KA 1
 #if KA
@@ -18,33 +39,192 @@
 #define KEEP_ALIVE(val) // pass
 #endif
 
+// Hardware counters of one benchmark run
+struct perf_counts
+{
+    static const int EVENTS = 6;
+    static constexpr const char *NAMES[EVENTS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"};
+    enum { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES };
+
+    int64_t counts[EVENTS] = {-1, -1, -1, -1, -1, -1}; // -1: event not available
+    double bytes = 0; // bytes moved by the run, set by clean_results
+
+    bool available() const
+    {
+        for (int e = 0; e < EVENTS; ++e)
+        {
+            if (counts[e] >= 0) return true;
+        }
+        return false;
+    }
+
+    // events per KiB moved, -1 if not available
+    double per_kib(int e) const
+    {
+        return counts[e] < 0 || bytes <= 0 ? -1 : counts[e] * 1024.0 / bytes;
+    }
+
+    double ipc() const
+    {
+        return counts[CYCLES] <= 0 || counts[INSTRUCTIONS] < 0 ? -1 : (double)counts[INSTRUCTIONS] / counts[CYCLES];
+    }
+};
+
+// perf_event_open counters around each run of bench(). User space only, which
+// perf_event_paranoid up to 2 allows for our own process, and only the calling
+// thread: threaded benchmarks count their main thread.
+// Events the machine (or the VM) does not have stay -1, and everything is a
+// no-op if none opens. Counts are scaled if the kernel multiplexes them.
+struct perf_counters
+{
+    int fds[perf_counts::EVENTS];
+    bool any = false;
+
+    perf_counters()
+    {
+        const uint32_t types[perf_counts::EVENTS] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+        const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const uint64_t configs[perf_counts::EVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_L1D | read_miss,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_CACHE_DTLB | read_miss, PERF_COUNT_HW_BRANCH_MISSES};
+        int error = 0;
+        for (int e = 0; e < perf_counts::EVENTS; ++e)
+        {
+            struct perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = types[e];
+            attr.config = configs[e];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds[e] == -1) error = errno;
+            else any = true;
+        }
+        if (!any)
+        {
+            fprintf(stderr, "perf_event_open failed (%s): hardware counters are n/a\n", strerror(error));
+        }
+    }
+
+    ~perf_counters()
+    {
+        for (int e = 0; e < perf_counts::EVENTS; ++e)
+        {
+            if (fds[e] != -1) close(fds[e]);
+        }
+    }
+
+    static perf_counters &get()
+    {
+        static perf_counters counters;
+        return counters;
+    }
+
+    void start()
+    {
+        if (!any) return;
+        for (int e = 0; e < perf_counts::EVENTS; ++e)
+        {
+            if (fds[e] == -1) continue;
+            ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    perf_counts stop()
+    {
+        perf_counts results;
+        if (!any) return results;
+        for (int e = 0; e < perf_counts::EVENTS; ++e)
+        {
+            if (fds[e] != -1) ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (int e = 0; e < perf_counts::EVENTS; ++e)
+        {
+            uint64_t values[3]; // value, time enabled, time running
+            if (fds[e] == -1 || read(fds[e], values, sizeof(values)) != sizeof(values)) continue;
+            if (values[2] == 0) continue; // never scheduled
+            results.counts[e] = values[2] < values[1] ? (int64_t)((double)values[0] * values[1] / values[2])
+                                                      : (int64_t)values[0];
+        }
+        return results;
+    }
+};
+
 struct bench_results
 {
     double seconds;
     double metric; // currently measuring gbps thruput
+    double first_seconds; // first iteration: includes page faults and cold caches
+    double first_metric;
+    perf_counts counters; // of the best run
+    std::vector<double> runs; // seconds of every run, in order
+    // over all runs, set by clean_results (GiB/s)
+    double median_metric;
+    double mean_metric;
+    double stddev_metric;
 };
 
 template <typename F, typename G>
 bench_results bench(const size_t iter, F fn, G pre_fn)
 {
     double min_seconds = 10000000.0; // init to high number
+    double first_seconds = 0;
     struct timespec start, end;
+    perf_counters &counters = perf_counters::get();
+    perf_counts best_counts;
+    std::vector<double> runs;
+    runs.reserve(iter);
 
     for (int i = 0; i < iter; ++i)
     {
         pre_fn();
+        counters.start();
         clock_gettime(CLOCK_MONOTONIC, &start);
         fn();
         clock_gettime(CLOCK_MONOTONIC, &end);
+        perf_counts run_counts = counters.stop();
         
         double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        runs.push_back(seconds);
+        if (i == 0)
+        {
+            first_seconds = seconds;
+        }
         if (seconds < min_seconds)
         {
             min_seconds = seconds;
+            best_counts = run_counts;
         }
     }
 
-    return (bench_results){ min_seconds };
+    bench_results results{};
+    results.seconds = min_seconds;
+    results.first_seconds = first_seconds;
+    results.counters = best_counts;
+    results.runs = std::move(runs);
+    return results;
+}
+
+// Median, mean and (sample) standard deviation of the throughput of every run
+void run_stats(const std::vector<double> &runs, double bytes, double *median, double *mean, double *stddev)
+{
+    const double gib = 1024.0 * 1024.0 * 1024.0;
+    std::vector<double> metrics;
+    for (double seconds : runs) metrics.push_back(bytes / seconds / gib);
+    std::sort(metrics.begin(), metrics.end());
+
+    size_t n = metrics.size();
+    *median = n == 0 ? 0 : n % 2 ? metrics[n / 2] : (metrics[n / 2 - 1] + metrics[n / 2]) / 2;
+    double sum = 0, squares = 0;
+    for (double m : metrics) sum += m;
+    *mean = n ? sum / n : 0;
+    for (double m : metrics) squares += (m - *mean) * (m - *mean);
+    *stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
 }
 
 // prints throughput to stdout, and writes perf metric (throughput) to result struct
@@ -52,14 +232,188 @@ void clean_results(bench_results *results, double bytes)
 {
     double bytes_per_sec = bytes / results->seconds;
     double gib_per_sec = bytes_per_sec / (1024.0 * 1024.0 * 1024.0);
+    double first_gib_per_sec = bytes / results->first_seconds / (1024.0 * 1024.0 * 1024.0);
     printf("    Throughput: %.3f GiB/s  (%.0f B/s)\n", gib_per_sec, bytes_per_sec);
+    printf("    First run:  %.3f GiB/s  (%.3f us)\n", first_gib_per_sec, results->first_seconds * 1e6);
     (*results).metric = gib_per_sec;
+    (*results).first_metric = first_gib_per_sec;
+    (*results).counters.bytes = bytes;
+    run_stats(results->runs, bytes, &results->median_metric, &results->mean_metric, &results->stddev_metric);
+    if (results->runs.size() > 1)
+    {
+        printf("    Median:     %.3f GiB/s  (stddev %.3f, %ld runs)\n",
+               results->median_metric, results->stddev_metric, results->runs.size());
+    }
+
+    const perf_counts &counters = results->counters;
+    if (counters.available())
+    {
+        printf("    Counters:   IPC ");
+        if (counters.ipc() < 0) printf("n/a");
+        else printf("%.2f", counters.ipc());
+        printf(", per KiB:");
+        for (int e = 0; e < perf_counts::EVENTS; ++e)
+        {
+            if (counters.per_kib(e) < 0) printf(" %s n/a", perf_counts::NAMES[e]);
+            else printf(" %s %.1f", perf_counts::NAMES[e], counters.per_kib(e));
+        }
+        printf("\n");
+    }
+}
+
+// CSV of the hardware counters, one row per benchmark and buffer, per KiB moved.
+// "n/a" where the event is not available.
+void print_counters_header(const char *size_name)
+{
+    printf("%s,test,buffer,gib_s,ipc", size_name);
+    for (int e = 0; e < perf_counts::EVENTS; ++e)
+    {
+        printf(",%s_kib", perf_counts::NAMES[e]);
+    }
+    printf("\n");
+}
+
+void print_counters_row(size_t size, const char *test, const char *buffer, double metric, const perf_counts &counters)
+{
+    printf("%ld,%s,%s,%lf,", size, test, buffer, metric);
+    if (counters.ipc() < 0) printf("n/a");
+    else printf("%lf", counters.ipc());
+    for (int e = 0; e < perf_counts::EVENTS; ++e)
+    {
+        if (counters.per_kib(e) < 0) printf(",n/a");
+        else printf(",%lf", counters.per_kib(e));
+    }
+    printf("\n");
+}
+
+// HDR style histogram of latencies in TSC cycles: 64 linear buckets per power
+// of two, so every value is kept within ~1.6% (exact below 128 cycles).
+struct latency_histogram
+{
+    static const int SUB_BITS = 6;
+    std::vector<uint64_t> counts = std::vector<uint64_t>(64 << SUB_BITS);
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    void record(uint64_t cycles)
+    {
+        int msb = 63 - __builtin_clzll(cycles | 1);
+        size_t index = cycles;
+        if (msb >= SUB_BITS)
+        {
+            int group = msb - SUB_BITS + 1;
+            index = (group << SUB_BITS) + ((cycles >> (group - 1)) - (1ul << SUB_BITS));
+        }
+        ++counts[index];
+        ++total;
+        if (cycles > max) max = cycles;
+    }
+
+    // upper bound of the bucket holding the `p` quantile (0..1)
+    uint64_t percentile(double p) const
+    {
+        uint64_t rank = (uint64_t)(p * total);
+        uint64_t seen = 0;
+        for (size_t index = 0; index < counts.size(); ++index)
+        {
+            seen += counts[index];
+            if (seen > rank)
+            {
+                size_t group = index >> SUB_BITS;
+                size_t sub = index & ((1ul << SUB_BITS) - 1);
+                if (group == 0) return sub;
+                uint64_t upper = (((sub + (1ul << SUB_BITS)) + 1) << (group - 1)) - 1;
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+};
+
+// TSC ticks per nanosecond, measured once against CLOCK_MONOTONIC
+double tsc_per_ns()
+{
+    static const double ratio = []() {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t tsc_start = __rdtsc();
+        do
+        {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        } while ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec) < 50e6);
+        uint64_t tsc_end = __rdtsc();
+        double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        return (tsc_end - tsc_start) / ns;
+    }();
+    return ratio;
+}
+
+// Cycles of one timed call to `fn`. The fences keep `fn` between the two
+// reads of the TSC (rdtscp waits for `fn` to retire).
+template <typename F>
+inline uint64_t time_cycles(F fn)
+{
+    unsigned int aux;
+    _mm_lfence();
+    uint64_t start = __rdtsc();
+    _mm_lfence();
+    fn();
+    uint64_t end = __rdtscp(&aux);
+    _mm_lfence();
+    return end - start;
+}
+
+// Cost of timing an empty call, taken off every sample
+uint64_t tsc_overhead()
+{
+    static const uint64_t overhead = []() {
+        uint64_t min_cycles = UINT64_MAX;
+        for (int i = 0; i < 10000; ++i)
+        {
+            uint64_t cycles = time_cycles([](){});
+            if (cycles < min_cycles) min_cycles = cycles;
+        }
+        return min_cycles;
+    }();
+    return overhead;
+}
+
+template <typename F>
+inline void record_latency(latency_histogram *hist, F fn)
+{
+    uint64_t cycles = time_cycles(fn);
+    hist->record(cycles > tsc_overhead() ? cycles - tsc_overhead() : 0);
+}
+
+struct latency_results
+{
+    double p50; // all in nanoseconds
+    double p99;
+    double p999;
+    double max;
+};
+
+// prints latency percentiles to stdout, and returns them in nanoseconds
+latency_results clean_latency(const latency_histogram *hist)
+{
+    double ratio = tsc_per_ns();
+    latency_results results = {
+        hist->percentile(0.50) / ratio,
+        hist->percentile(0.99) / ratio,
+        hist->percentile(0.999) / ratio,
+        hist->max / ratio
+    };
+    printf("    Latency: p50 %.1f ns, p99 %.1f ns, p99.9 %.1f ns, max %.1f ns\n",
+           results.p50, results.p99, results.p999, results.max);
+    return results;
 }
 
 struct bench_results_bufs
 {
     double cbuf_metric;
     double buf_metric;
+    perf_counts cbuf_counters;
+    perf_counts buf_counters;
 };
 
 // Writes sequentially through the buffer, element by element.
@@ -92,7 +446,8 @@ bench_results_bufs bench_sequential_write_typed(Buffer<uint32_t>* buf, CBuffer<u
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, bytes);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // Reads sequentially through the buffer, accumulating a checksum.
@@ -138,7 +493,8 @@ bench_results_bufs bench_sequential_read_typed(Buffer<uint32_t>* buf, CBuffer<ui
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, bytes);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // Writes with a wraparound, element by element.
@@ -171,7 +527,8 @@ bench_results_bufs bench_wraparound_write_typed(Buffer<uint32_t>* buf, CBuffer<u
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, bytes);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // Reads with a wraparound, accumulating a checksum.
@@ -217,7 +574,8 @@ bench_results_bufs bench_wraparound_read_typed(Buffer<uint32_t>* buf, CBuffer<ui
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, bytes);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 void typed_buffer_benchmark() {
@@ -240,13 +598,24 @@ void typed_buffer_benchmark() {
 
     printf("count,buf_seq_w,cbuf_seq_w,buf_seq_r,cbuf_seq_r,buf_wrap_w,cbuf_wrap_w,buf_wrap_r,cbuf_wrap_r,\n");
     for (i = 0; i < loops; ++i) {
-        printf("%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,\n",counts[i],
+        printf("%zu,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,\n",counts[i],
             bench_results_metrics[0+4*i].buf_metric, bench_results_metrics[0+4*i].cbuf_metric,
             bench_results_metrics[1+4*i].buf_metric, bench_results_metrics[1+4*i].cbuf_metric,
             bench_results_metrics[2+4*i].buf_metric, bench_results_metrics[2+4*i].cbuf_metric,
             bench_results_metrics[3+4*i].buf_metric, bench_results_metrics[3+4*i].cbuf_metric
         );
     }
+
+    const char *tests[4] = {"seq_w", "seq_r", "wrap_w", "wrap_r"};
+    printf("\n");
+    print_counters_header("count");
+    for (i = 0; i < loops; ++i) {
+        for (int t = 0; t < 4; ++t) {
+            const bench_results_bufs &r = bench_results_metrics[t+4*i];
+            print_counters_row(counts[i], tests[t], "buf", r.buf_metric, r.buf_counters);
+            print_counters_row(counts[i], tests[t], "cbuf", r.cbuf_metric, r.cbuf_counters);
+        }
+    }
 }
 
 // struct SomeData
@@ -307,7 +676,8 @@ bench_results_bufs bench_sequential_write_byte(ByteBuffer* buf, CByteBuffer* cbu
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, count);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // Reads sequentially through the buffer, accumulating a checksum.
@@ -360,7 +730,8 @@ bench_results_bufs bench_sequential_read_byte(ByteBuffer* buf, CByteBuffer* cbuf
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, count);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // Writes with a wraparound, element by element.
@@ -405,7 +776,8 @@ bench_results_bufs bench_wraparound_write_byte(ByteBuffer* buf, CByteBuffer* cbu
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, count);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // Reads with a wraparound, accumulating a checksum.
@@ -462,7 +834,8 @@ bench_results_bufs bench_wraparound_read_byte(ByteBuffer* buf, CByteBuffer* cbuf
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, count);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 // `iter` how many iterations
@@ -522,12 +895,111 @@ bench_results_bufs bench_alternate_read_write_byte(ByteBuffer* buf, CByteBuffer*
     printf("  CBuffer best run:\n");
     clean_results(&bench_results_cbuf, count);
 
-    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric };
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
+}
+
+// Writes through the buffer in chunks of up to 256 items, one PushN per chunk.
+// 
+// `iter` how many iterations
+// `count` is length of buffers (bytes)
+bench_results_bufs bench_bulk_write_byte(ByteBuffer* buf, CByteBuffer* cbuf, size_t count, size_t iter)
+{
+    printf("\nBulk write, buffer size: %ld\n", count);
+    size_t items = count/sizeof(SomeData)-1;
+    size_t chunk = items < 256 ? items : 256;
+    std::vector<SomeData> src(chunk, tmp_);
+
+    bench_results bench_results_buf = bench(iter, [&]() {
+        for (size_t i = 0; i < items/chunk; ++i)
+        {
+            buf->PushN(src.data(), chunk);
+        }
+        KEEP_ALIVE(buf->Data);
+    }, [&](){ buf->Reset(); });
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        for (size_t i = 0; i < items/chunk; ++i)
+        {
+            cbuf->PushN(src.data(), chunk);
+        }
+        KEEP_ALIVE(cbuf->Data);
+    }, [&](){ cbuf->Reset(); });
+    double bytes = (double)sizeof(SomeData) * (items/chunk) * chunk;
+
+    printf("  Buffer best run:\n");
+    clean_results(&bench_results_buf, bytes);
+
+    printf("  CBuffer best run:\n");
+    clean_results(&bench_results_cbuf, bytes);
+
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
+}
+
+// Reads through the buffer in chunks of up to 256 items, one PopN per chunk,
+// accumulating a checksum.
+// 
+// `iter` how many iterations
+// `count` is length of buffers (bytes)
+bench_results_bufs bench_bulk_read_byte(ByteBuffer* buf, CByteBuffer* cbuf, size_t count, size_t iter)
+{
+    size_t items = count/sizeof(SomeData)-1;
+    size_t chunk = items < 256 ? items : 256;
+    size_t expected_sum = (items/chunk) * tmp_.d;
+    std::vector<SomeData> dst(chunk);
+
+    printf("\nBulk read, buffer size: %ld\n", count);
+    bench_results bench_results_buf = bench(iter, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < items/chunk; ++i)
+        {
+            buf->PopN(dst.data(), chunk);
+            sum += dst[chunk-1].d;
+        }
+        KEEP_ALIVE(sum);
+        assert(expected_sum == sum);
+    }, [&](){
+        buf->Reset();
+        for (size_t i = 0; i < items; ++i)
+        {
+            buf->Push(tmp_);
+        }
+        KEEP_ALIVE(buf->Data);
+    });
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < items/chunk; ++i)
+        {
+            cbuf->PopN(dst.data(), chunk);
+            sum += dst[chunk-1].d;
+        }
+        KEEP_ALIVE(sum);
+        assert(expected_sum == sum);
+    }, [&](){
+        cbuf->Reset();
+        for (size_t i = 0; i < items; ++i)
+        {
+            cbuf->Push(tmp_);
+        }
+        KEEP_ALIVE(cbuf->Data);
+    });
+    double bytes = (double)sizeof(SomeData) * (items/chunk) * chunk;
+
+    printf("  Buffer best run:\n");
+    clean_results(&bench_results_buf, bytes);
+
+    printf("  CBuffer best run:\n");
+    clean_results(&bench_results_cbuf, bytes);
+
+    return (bench_results_bufs){ bench_results_cbuf.metric, bench_results_buf.metric,
+                                 bench_results_cbuf.counters, bench_results_buf.counters };
 }
 
 void byte_buffer_benchmark() {
     int i;
-    int tests = 5;
+    int tests = 7;
     int loops = 7; //   4k    64k      512k      4m         8m         16m        256m
     size_t bytes[loops] = {4096, 16*4096, 128*4096, 1024*4096 , 2048*4096, 4096*4096, 16*4096*4096};
     size_t iters[loops] = {100000, 10000,  1000,     1000      , 100,         500,       100};
@@ -547,24 +1019,2206 @@ void byte_buffer_benchmark() {
         bench_results_metrics[3+tests*i] = bench_wraparound_read_byte(&buf, &cbuf, bytes[i], iters[i]);
         buf.Reset(); cbuf.Reset();
         bench_results_metrics[4+tests*i] = bench_alternate_read_write_byte(&buf, &cbuf, bytes[i], iters[i]);
+        buf.Reset(); cbuf.Reset();
+        bench_results_metrics[5+tests*i] = bench_bulk_write_byte(&buf, &cbuf, bytes[i], iters[i]);
+        buf.Reset(); cbuf.Reset();
+        bench_results_metrics[6+tests*i] = bench_bulk_read_byte(&buf, &cbuf, bytes[i], iters[i]);
     }
     
-    printf("bytes,buf_seq_w,cbuf_seq_w,buf_seq_r,cbuf_seq_r,buf_wrap_w,cbuf_wrap_w,buf_wrap_r,cbuf_wrap_r,buf_alt,cbuf_alt\n");
+    printf("bytes,buf_seq_w,cbuf_seq_w,buf_seq_r,cbuf_seq_r,buf_wrap_w,cbuf_wrap_w,buf_wrap_r,cbuf_wrap_r,buf_alt,cbuf_alt,buf_bulk_w,cbuf_bulk_w,buf_bulk_r,cbuf_bulk_r\n");
     for (i = 0; i < loops; ++i) {
-        printf("%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n",bytes[i],
+        printf("%zu,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n",bytes[i],
             bench_results_metrics[0+tests*i].buf_metric, bench_results_metrics[0+tests*i].cbuf_metric,
             bench_results_metrics[1+tests*i].buf_metric, bench_results_metrics[1+tests*i].cbuf_metric,
             bench_results_metrics[2+tests*i].buf_metric, bench_results_metrics[2+tests*i].cbuf_metric,
             bench_results_metrics[3+tests*i].buf_metric, bench_results_metrics[3+tests*i].cbuf_metric,
-            bench_results_metrics[4+tests*i].buf_metric, bench_results_metrics[4+tests*i].cbuf_metric
+            bench_results_metrics[4+tests*i].buf_metric, bench_results_metrics[4+tests*i].cbuf_metric,
+            bench_results_metrics[5+tests*i].buf_metric, bench_results_metrics[5+tests*i].cbuf_metric,
+            bench_results_metrics[6+tests*i].buf_metric, bench_results_metrics[6+tests*i].cbuf_metric
+        );
+    }
+
+    const char *names[7] = {"seq_w", "seq_r", "wrap_w", "wrap_r", "alt", "bulk_w", "bulk_r"};
+    printf("\n");
+    print_counters_header("bytes");
+    for (i = 0; i < loops; ++i) {
+        for (int t = 0; t < tests; ++t) {
+            const bench_results_bufs &r = bench_results_metrics[t+tests*i];
+            print_counters_row(bytes[i], names[t], "buf", r.buf_metric, r.buf_counters);
+            print_counters_row(bytes[i], names[t], "cbuf", r.cbuf_metric, r.cbuf_counters);
+        }
+    }
+}
+
+// Streams `items` through the queue with `threads` producers and `threads` consumers,
+// claiming `batch` items at a time.
+//
+// `iter` how many iterations
+bench_results bench_mpmc(CMpmcBuffer<uint64_t>* queue, int threads, size_t batch, size_t items, size_t iter)
+{
+    size_t per_thread = items / threads / batch;
+    uint64_t expected_sum = (uint64_t)threads * per_thread * batch;
+
+    bench_results bench_results_queue = bench(iter, [&]() {
+        std::atomic<uint64_t> sum(0);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&]() {
+                std::vector<uint64_t> src(batch, 1);
+                for (size_t i = 0; i < per_thread; ++i)
+                {
+                    while (!queue->TryPushN(src.data(), batch)) std::this_thread::yield();
+                }
+            });
+            workers.emplace_back([&]() {
+                std::vector<uint64_t> dst(batch);
+                uint64_t local = 0;
+                for (size_t i = 0; i < per_thread; ++i)
+                {
+                    while (!queue->TryPopN(dst.data(), batch)) std::this_thread::yield();
+                    for (size_t j = 0; j < batch; ++j) local += dst[j];
+                }
+                sum += local;
+            });
+        }
+        for (auto &w : workers) w.join();
+        KEEP_ALIVE(sum.load());
+        assert(expected_sum == sum.load());
+    }, [&](){ queue->Reset(); });
+
+    printf("  %d producers / %d consumers, batch %ld:\n", threads, threads, batch);
+    clean_results(&bench_results_queue, (double)sizeof(uint64_t) * threads * per_thread * batch);
+    return bench_results_queue;
+}
+
+void mpmc_scaling_benchmark() {
+    int i;
+    int loops = 6;
+    int threads[6] = {1, 2, 4, 8, 16, 32};
+    size_t items = 1 << 22;
+    size_t iter = 10;
+
+    CMpmcBuffer<uint64_t> queue(64 * 1024);
+    bench_results bench_results_metrics[2*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        printf("\nMPMC scaling, threads: %d\n", threads[i]);
+        bench_results_metrics[0+2*i] = bench_mpmc(&queue, threads[i], 1, items, iter);
+        bench_results_metrics[1+2*i] = bench_mpmc(&queue, threads[i], 64, items, iter);
+    }
+
+    printf("threads,mpmc,mpmc_batch64,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%d,%lf,%lf,\n",threads[i],
+            bench_results_metrics[0+2*i].metric, bench_results_metrics[1+2*i].metric
+        );
+    }
+}
+
+// Reads random items from the buffer, accumulating a checksum.
+// Every access likely lands on a different page: a dTLB miss per access
+// on regular pages once the buffer is bigger than the TLB reach.
+// 
+// `iter` how many iterations
+// `count` is length of buffer (items), must be a power of two
+bench_results bench_random_read_typed(CBuffer<uint32_t>* cbuf, size_t count, size_t iter)
+{
+    size_t accesses = 1 << 22;
+    for (size_t i = 0; i < count; ++i)
+    {
+        (*cbuf)[i] = 1;
+    }
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        int64_t sum = 0;
+        uint64_t x = 88172645463325252ull;
+        for (size_t i = 0; i < accesses; ++i)
+        {
+            // xorshift64
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            sum += (*cbuf)[x & (count - 1)];
+        }
+        KEEP_ALIVE(sum);
+        assert(sum == (int64_t)accesses);
+    }, [&](){});
+
+    printf("  CBuffer best run, page size %ld:\n", cbuf->PageSize);
+    clean_results(&bench_results_cbuf, (double)sizeof(uint32_t) * accesses);
+    return bench_results_cbuf;
+}
+
+void tlb_benchmark() {
+    int i;
+    int loops = 4; //   8m         64m         256m           1g
+    size_t counts[4] = {2048*1024, 16*1024*1024, 64*1024*1024, 256*1024*1024};
+    size_t iters[4] = {20, 20, 10, 5};
+
+    CBufferOptions huge_options;
+    huge_options.HugePageSize = HUGE_PAGE_2MB;
+
+    bench_results bench_results_metrics[2*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        printf("\nRandom read, buffer size: %ld\n", counts[i] * sizeof(uint32_t));
+        CBuffer<uint32_t> cbuf(counts[i] * sizeof(uint32_t), 2);
+        CBuffer<uint32_t> hbuf(counts[i] * sizeof(uint32_t), 2, huge_options);
+        if (hbuf.PageSize != HUGE_PAGE_2MB)
+        {
+            printf("  no huge pages available (vm.nr_hugepages), both runs use regular pages\n");
+        }
+        bench_results_metrics[0+2*i] = bench_random_read_typed(&cbuf, counts[i], iters[i]);
+        bench_results_metrics[1+2*i] = bench_random_read_typed(&hbuf, counts[i], iters[i]);
+    }
+
+    printf("bytes,cbuf_4k_rand_r,cbuf_2m_rand_r,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,\n",counts[i] * sizeof(uint32_t),
+            bench_results_metrics[0+2*i].metric, bench_results_metrics[1+2*i].metric
         );
     }
 }
 
-int main()
+// Streams `laps` times the buffer size through it, alternating 16 pushes and 16 pops.
+// 
+// `iter` how many iterations
+// `count` is length of buffer (bytes)
+bench_results bench_stream_byte(CByteBuffer* cbuf, size_t count, size_t laps, size_t iter)
 {
-    // typed_buffer_benchmark();
-    byte_buffer_benchmark();
+    size_t alt_every = 16;
+    size_t rounds = laps * (count / sizeof(SomeData)) / alt_every;
+    size_t expected_sum = rounds * alt_every * tmp_.d;
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            for (size_t j = 0; j < alt_every; ++j)
+            {
+                cbuf->Push(tmp_);
+            }
+            for (size_t j = 0; j < alt_every; ++j)
+            {
+                sum += cbuf->Pop<SomeData>().d;
+            }
+        }
+        KEEP_ALIVE(sum);
+        assert(expected_sum == sum);
+    }, [&](){ cbuf->Reset(); });
+
+    printf("  CByteBuffer best run, %ld views:\n", cbuf->GetPageCount());
+    clean_results(&bench_results_cbuf, (double)sizeof(SomeData) * rounds * alt_every);
+    return bench_results_cbuf;
+}
 
+// 16x virtual mirror against the double mapping (2 views, masked indices)
+void mirror_mode_benchmark() {
+    int i;
+    int loops = 5; //   4k    64k      512k      4m         16m
+    size_t bytes[5] = {4096, 16*4096, 128*4096, 1024*4096, 4096*4096};
+    size_t laps[5] = {64, 32, 8, 4, 2};
+    size_t iter = 20;
+
+    CBufferOptions double_options;
+    double_options.Mode = MirrorMode::Double;
+
+    bench_results bench_results_metrics[2*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        printf("\nStreaming, buffer size: %ld\n", bytes[i]);
+        CByteBuffer vbuf(bytes[i], 16);
+        CByteBuffer dbuf(bytes[i], double_options);
+        bench_results_metrics[0+2*i] = bench_stream_byte(&vbuf, bytes[i], laps[i], iter);
+        bench_results_metrics[1+2*i] = bench_stream_byte(&dbuf, bytes[i], laps[i], iter);
+    }
+
+    printf("bytes,cbuf_16x_stream,cbuf_2x_stream,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,\n",bytes[i],
+            bench_results_metrics[0+2*i].metric, bench_results_metrics[1+2*i].metric
+        );
+    }
+}
+
+// Gets a fresh buffer and gives it back, `ops` times: cold construction and
+// destruction against CBufferPool::Acquire()/Release().
+// Returns nanoseconds per buffer.
+// 
+// `iter` how many iterations
+// `count` is length of buffer (bytes)
+bench_results_bufs bench_startup_byte(CBufferPool* pool, size_t count, size_t ops, size_t iter)
+{
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+
+    printf("\nStartup, buffer size: %ld\n", count);
+    bench_results bench_results_cold = bench(iter, [&]() {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            CByteBuffer cbuf(count, options);
+            cbuf.Push(tmp_);
+            KEEP_ALIVE(cbuf.Data);
+        }
+    }, [&](){});
+
+    bench_results bench_results_pool = bench(iter, [&]() {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            CByteBuffer *cbuf = pool->Acquire(count);
+            cbuf->Push(tmp_);
+            KEEP_ALIVE(cbuf->Data);
+            pool->Release(cbuf);
+        }
+    }, [&](){});
+
+    double cold_ns = bench_results_cold.seconds * 1e9 / ops;
+    double pool_ns = bench_results_pool.seconds * 1e9 / ops;
+    printf("  Cold construction best run:\n    Latency: %.1f ns\n", cold_ns);
+    printf("  Pooled acquisition best run:\n    Latency: %.1f ns\n", pool_ns);
+
+    return (bench_results_bufs){ pool_ns, cold_ns };
+}
+
+void startup_benchmark() {
+    int i;
+    int loops = 4; //   4k    64k      512k      4m
+    size_t bytes[4] = {4096, 16*4096, 128*4096, 1024*4096};
+    size_t ops = 1000;
+    size_t iter = 10;
+
+    CBufferPool pool(std::vector<size_t>(bytes, bytes + loops), 4);
+    bench_results_bufs bench_results_metrics[loops];
+    for (i = 0; i < loops; ++i)
+    {
+        bench_results_metrics[i] = bench_startup_byte(&pool, bytes[i], ops, iter);
+    }
+
+    printf("bytes,cold_ns,pooled_ns,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,\n",bytes[i],
+            bench_results_metrics[i].buf_metric, bench_results_metrics[i].cbuf_metric
+        );
+    }
+}
+
+// Pins the calling thread to `cpu`
+void pin_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// CPUs in a sysfs cpulist file (format: "0-3,8,10-11"), empty if there is no such file
+std::vector<int> read_cpulist(const std::string &path)
+{
+    std::vector<int> cpus;
+    std::ifstream file(path);
+    std::string range;
+    while (std::getline(file, range, ','))
+    {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1) continue;
+        if (n == 1) last = first;
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// CPUs of a NUMA node, from sysfs
+std::vector<int> node_cpus(int node)
+{
+    std::vector<int> cpus = read_cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (cpus.empty()) cpus.push_back(0); // no sysfs: assume a single node
+    return cpus;
+}
+
+// Number of NUMA nodes, from sysfs
+int numa_node_count()
+{
+    int nodes = 0;
+    while (std::ifstream("/sys/devices/system/node/node" + std::to_string(nodes) + "/cpulist").good()) ++nodes;
+    return nodes > 0 ? nodes : 1;
+}
+
+// Streams `items` records from a producer pinned to `producer_cpu` to a
+// consumer pinned to `consumer_cpu`.
+// 
+// `iter` how many iterations
+bench_results bench_spsc_stream_byte(CSpscByteBuffer* qbuf, int producer_cpu, int consumer_cpu, size_t items, size_t iter)
+{
+    size_t expected_sum = items * tmp_.d;
+
+    bench_results bench_results_qbuf = bench(iter, [&]() {
+        std::thread producer([&]() {
+            pin_thread(producer_cpu);
+            for (size_t i = 0; i < items; ++i)
+            {
+                while (!qbuf->TryPush(tmp_)) std::this_thread::yield();
+            }
+        });
+        std::thread consumer([&]() {
+            pin_thread(consumer_cpu);
+            int64_t sum = 0;
+            SomeData data;
+            for (size_t i = 0; i < items; ++i)
+            {
+                while (!qbuf->TryPop(data)) std::this_thread::yield();
+                sum += data.d;
+            }
+            KEEP_ALIVE(sum);
+            assert(expected_sum == sum);
+        });
+        producer.join();
+        consumer.join();
+    }, [&](){ qbuf->Reset(); });
+
+    printf("  CSpscByteBuffer best run, cpu %d -> cpu %d:\n", producer_cpu, consumer_cpu);
+    clean_results(&bench_results_qbuf, (double)sizeof(SomeData) * items);
+    return bench_results_qbuf;
+}
+
+// Producer on the first NUMA node, consumer on the last one, with the buffer
+// bound to the producer's node, to the consumer's node, or left to first touch.
+void numa_benchmark() {
+    int i;
+    int loops = 3; //   64k      512k      4m
+    size_t bytes[3] = {16*4096, 128*4096, 1024*4096};
+    size_t items = 1 << 22;
+    size_t iter = 5;
+
+    int producer_node = 0;
+    int consumer_node = numa_node_count() - 1;
+    int producer_cpu = node_cpus(producer_node).front();
+    int consumer_cpu = node_cpus(consumer_node).back();
+    if (producer_node == consumer_node)
+    {
+        printf("only one NUMA node, all runs are node local\n");
+    }
+
+    bench_results bench_results_metrics[3*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        printf("\nCross node streaming, buffer size: %ld\n", bytes[i]);
+        CBufferOptions options;
+        options.Populate = true;
+
+        options.NumaNode = producer_node;
+        CSpscByteBuffer pbuf(bytes[i], options);
+        bench_results_metrics[0+3*i] = bench_spsc_stream_byte(&pbuf, producer_cpu, consumer_cpu, items, iter);
+
+        options.NumaNode = consumer_node;
+        CSpscByteBuffer cbuf(bytes[i], options);
+        bench_results_metrics[1+3*i] = bench_spsc_stream_byte(&cbuf, producer_cpu, consumer_cpu, items, iter);
+
+        CSpscByteBuffer fbuf(bytes[i]);
+        bench_results_metrics[2+3*i] = bench_spsc_stream_byte(&fbuf, producer_cpu, consumer_cpu, items, iter);
+    }
+
+    printf("bytes,spsc_producer_node,spsc_consumer_node,spsc_first_touch,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,%lf,\n",bytes[i],
+            bench_results_metrics[0+3*i].metric, bench_results_metrics[1+3*i].metric, bench_results_metrics[2+3*i].metric
+        );
+    }
+}
+
+// Writes sequentially through every view of a fresh virtual buffer.
+// Without prefaulting, the first iteration takes a page fault per page per view.
+// 
+// `iter` how many iterations
+// `count` is length of buffer (bytes)
+bench_results bench_first_touch_byte(size_t count, const CBufferOptions &options, size_t iter)
+{
+    CByteBuffer cbuf(count, 16, options);
+    size_t items = 15 * count / sizeof(SomeData);
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        for (size_t i = 0; i < items; ++i)
+        {
+            cbuf.Push(tmp_);
+        }
+        KEEP_ALIVE(cbuf.Data);
+    }, [&](){ cbuf.Reset(); });
+
+    printf("  CByteBuffer (prefault %d, lock %d) best run:\n", options.Prefault, options.Lock);
+    clean_results(&bench_results_cbuf, (double)sizeof(SomeData) * items);
+    return bench_results_cbuf;
+}
+
+void first_touch_benchmark() {
+    int i;
+    int loops = 4; //   64k      512k      4m         16m
+    size_t bytes[4] = {16*4096, 128*4096, 1024*4096, 4096*4096};
+    size_t iter = 10;
+
+    CBufferOptions prefault_options;
+    prefault_options.Prefault = true;
+    CBufferOptions lock_options;
+    lock_options.Prefault = true;
+    lock_options.Lock = true;
+
+    bench_results bench_results_metrics[3*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        printf("\nFirst touch write, buffer size: %ld\n", bytes[i]);
+        bench_results_metrics[0+3*i] = bench_first_touch_byte(bytes[i], CBufferOptions(), iter);
+        bench_results_metrics[1+3*i] = bench_first_touch_byte(bytes[i], prefault_options, iter);
+        bench_results_metrics[2+3*i] = bench_first_touch_byte(bytes[i], lock_options, iter);
+    }
+
+    printf("bytes,cbuf_first,cbuf_best,cbuf_prefault_first,cbuf_prefault_best,cbuf_lock_first,cbuf_lock_best,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,%lf,%lf,%lf,%lf,\n",bytes[i],
+            bench_results_metrics[0+3*i].first_metric, bench_results_metrics[0+3*i].metric,
+            bench_results_metrics[1+3*i].first_metric, bench_results_metrics[1+3*i].metric,
+            bench_results_metrics[2+3*i].first_metric, bench_results_metrics[2+3*i].metric
+        );
+    }
+}
+
+struct latency_results_bufs
+{
+    latency_results buf_push;
+    latency_results cbuf_push;
+    latency_results buf_pop;
+    latency_results cbuf_pop;
+};
+
+// Times every single Push and Pop, alternating 16 of each, `ops` times
+// through each buffer.
+// 
+// `count` is length of buffers (bytes)
+latency_results_bufs bench_latency_byte(ByteBuffer* buf, CByteBuffer* cbuf, size_t count, size_t ops)
+{
+    size_t alt_every = 16;
+    latency_histogram buf_push, cbuf_push, buf_pop, cbuf_pop;
+
+    printf("\nPush/Pop latency, buffer size: %ld\n", count);
+    for (size_t i = 0; i < ops / alt_every; ++i)
+    {
+        for (size_t j = 0; j < alt_every; ++j)
+        {
+            record_latency(&buf_push, [&]() { buf->Push(tmp_); });
+        }
+        for (size_t j = 0; j < alt_every; ++j)
+        {
+            record_latency(&buf_pop, [&]() { KEEP_ALIVE(buf->Pop<SomeData>().d); });
+        }
+    }
+    for (size_t i = 0; i < ops / alt_every; ++i)
+    {
+        for (size_t j = 0; j < alt_every; ++j)
+        {
+            record_latency(&cbuf_push, [&]() { cbuf->Push(tmp_); });
+        }
+        for (size_t j = 0; j < alt_every; ++j)
+        {
+            record_latency(&cbuf_pop, [&]() { KEEP_ALIVE(cbuf->Pop<SomeData>().d); });
+        }
+    }
+
+    latency_results_bufs results;
+    printf("  Buffer Push:\n");
+    results.buf_push = clean_latency(&buf_push);
+    printf("  Buffer Pop:\n");
+    results.buf_pop = clean_latency(&buf_pop);
+    printf("  CBuffer Push:\n");
+    results.cbuf_push = clean_latency(&cbuf_push);
+    printf("  CBuffer Pop:\n");
+    results.cbuf_pop = clean_latency(&cbuf_pop);
+    return results;
+}
+
+void latency_benchmark() {
+    int i;
+    int loops = 5; //   4k    64k      512k      4m         16m
+    size_t bytes[5] = {4096, 16*4096, 128*4096, 1024*4096, 4096*4096};
+    size_t ops = 1 << 20;
+
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+
+    latency_results_bufs latency_metrics[loops];
+    for (i = 0; i < loops; ++i)
+    {
+        ByteBuffer buf(bytes[i]);
+        CByteBuffer cbuf(bytes[i], options);
+        latency_metrics[i] = bench_latency_byte(&buf, &cbuf, bytes[i], ops);
+    }
+
+    printf("bytes,"
+           "buf_push_p50,buf_push_p99,buf_push_p999,buf_push_max,"
+           "cbuf_push_p50,cbuf_push_p99,cbuf_push_p999,cbuf_push_max,"
+           "buf_pop_p50,buf_pop_p99,buf_pop_p999,buf_pop_max,"
+           "cbuf_pop_p50,cbuf_pop_p99,cbuf_pop_p999,cbuf_pop_max\n");
+    for (i = 0; i < loops; ++i) {
+        latency_results *r[4] = { &latency_metrics[i].buf_push, &latency_metrics[i].cbuf_push,
+                                  &latency_metrics[i].buf_pop, &latency_metrics[i].cbuf_pop };
+        printf("%ld", bytes[i]);
+        for (int j = 0; j < 4; ++j)
+        {
+            printf(",%lf,%lf,%lf,%lf", r[j]->p50, r[j]->p99, r[j]->p999, r[j]->max);
+        }
+        printf("\n");
+    }
+}
+
+// Where the producer and the consumer run
+struct core_pair
+{
+    const char *name;
+    int producer_cpu;
+    int consumer_cpu;
+};
+
+// Same core, SMT sibling, same socket and cross socket pairs for cpu 0,
+// from the sysfs topology. Pairs this machine does not have are left out.
+std::vector<core_pair> default_core_pairs()
+{
+    const std::string topology = "/sys/devices/system/cpu/cpu0/topology/";
+    std::vector<int> online = read_cpulist("/sys/devices/system/cpu/online");
+    std::vector<int> siblings = read_cpulist(topology + "thread_siblings_list");
+    std::vector<int> package = read_cpulist(topology + "package_cpus_list");
+    auto contains = [](const std::vector<int> &cpus, int cpu) {
+        return std::find(cpus.begin(), cpus.end(), cpu) != cpus.end();
+    };
+
+    std::vector<core_pair> pairs = { {"same_core", 0, 0} };
+    for (int cpu : siblings)
+    {
+        if (cpu != 0) { pairs.push_back({"smt_sibling", 0, cpu}); break; }
+    }
+    for (int cpu : package)
+    {
+        if (!contains(siblings, cpu)) { pairs.push_back({"same_socket", 0, cpu}); break; }
+    }
+    for (int cpu : online)
+    {
+        if (!package.empty() && !contains(package, cpu)) { pairs.push_back({"cross_socket", 0, cpu}); break; }
+    }
+    return pairs;
+}
+
+// Uniform record interface over the buffers, records are length prefixed.
+// ByteBuffer and CByteBuffer are not thread safe: a mutex around every call,
+// plus a byte count for full/empty, like you would use them today.
+template <typename B>
+struct locked_records
+{
+    B *buffer;
+    size_t capacity;
+    size_t used = 0;
+    std::mutex lock;
+
+    bool try_write(const std::byte *record, uint32_t size)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (capacity - used < sizeof(uint32_t) + size) return false;
+        buffer->Push(size);
+        buffer->PushN(record, size);
+        used += sizeof(uint32_t) + size;
+        return true;
+    }
+
+    uint32_t try_read(std::byte *record)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (used == 0) return 0;
+        uint32_t size = buffer->template Pop<uint32_t>();
+        buffer->PopN(record, size);
+        used -= sizeof(uint32_t) + size;
+        return size;
+    }
+
+    bool empty()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return used == 0;
+    }
+};
+
+// CSpscByteBuffer: lock free, records written and read in place
+struct spsc_records
+{
+    CSpscByteBuffer *buffer;
+
+    bool try_write(const std::byte *record, uint32_t size)
+    {
+        std::span<std::byte> out = buffer->Reserve(sizeof(uint32_t) + size);
+        if (out.empty()) return false;
+        std::memcpy(out.data(), &size, sizeof(uint32_t));
+        std::memcpy(out.data() + sizeof(uint32_t), record, size);
+        buffer->Commit(sizeof(uint32_t) + size);
+        return true;
+    }
+
+    uint32_t try_read(std::byte *record)
+    {
+        std::span<const std::byte> header = buffer->Peek(sizeof(uint32_t));
+        if (header.empty()) return 0;
+        uint32_t size;
+        std::memcpy(&size, header.data(), sizeof(uint32_t));
+        std::memcpy(record, buffer->Peek(sizeof(uint32_t) + size).data() + sizeof(uint32_t), size);
+        buffer->Consume(sizeof(uint32_t) + size);
+        return size;
+    }
+
+    bool empty()
+    {
+        return buffer->IsEmpty();
+    }
+};
+
+struct handoff_results
+{
+    double metric; // throughput (GiB/s), streaming
+    latency_results handoff; // producer push to consumer pop, one record in flight
+};
+
+// Streams `items` records from `pair.producer_cpu` to `pair.consumer_cpu`.
+// Every record starts with the producer's TSC, so the consumer can time the handoff.
+// Record sizes come from `sizes` (fixed or variable).
+//
+// `iter` how many iterations
+template <typename R>
+handoff_results bench_handoff(R *records, const core_pair &pair, const std::vector<uint32_t> &sizes, size_t items, size_t iter)
+{
+    size_t total_bytes = 0;
+    for (size_t i = 0; i < items; ++i) total_bytes += sizes[i % sizes.size()];
+
+    // throughput: as fast as the consumer keeps up
+    bench_results bench_results_stream = bench(iter, [&]() {
+        std::thread producer([&]() {
+            pin_thread(pair.producer_cpu);
+            std::byte record[256] = {};
+            for (size_t i = 0; i < items; ++i)
+            {
+                while (!records->try_write(record, sizes[i % sizes.size()])) std::this_thread::yield();
+            }
+        });
+        // a thread of its own: pinning the caller would pin every later benchmark
+        size_t bytes = 0;
+        std::thread consumer([&]() {
+            pin_thread(pair.consumer_cpu);
+            std::byte record[256];
+            for (size_t i = 0; i < items; ++i)
+            {
+                uint32_t size;
+                while ((size = records->try_read(record)) == 0) std::this_thread::yield();
+                bytes += size;
+            }
+        });
+        producer.join();
+        consumer.join();
+        KEEP_ALIVE(bytes);
+        assert(bytes == total_bytes);
+    }, [&](){});
+
+    // handoff latency: the producer waits for each record to be taken.
+    // Spin, unless both sides share a CPU and have to take turns.
+    auto wait = [&]() {
+        if (pair.producer_cpu == pair.consumer_cpu) std::this_thread::yield();
+        else _mm_pause();
+    };
+    latency_histogram hist;
+    size_t samples = items < 65536 ? items : 65536;
+    std::thread producer([&]() {
+        pin_thread(pair.producer_cpu);
+        std::byte record[256] = {};
+        for (size_t i = 0; i < samples; ++i)
+        {
+            uint64_t tsc = __rdtsc();
+            std::memcpy(record, &tsc, sizeof(tsc));
+            while (!records->try_write(record, sizes[i % sizes.size()])) std::this_thread::yield();
+            while (!records->empty()) wait();
+        }
+    });
+    std::thread consumer([&]() {
+        pin_thread(pair.consumer_cpu);
+        std::byte record[256];
+        for (size_t i = 0; i < samples; ++i)
+        {
+            while (records->try_read(record) == 0) wait();
+            uint64_t tsc;
+            std::memcpy(&tsc, record, sizeof(tsc));
+            hist.record(__rdtsc() - tsc);
+        }
+    });
+    producer.join();
+    consumer.join();
+
+    handoff_results results;
+    clean_results(&bench_results_stream, (double)total_bytes);
+    results.metric = bench_results_stream.metric;
+    results.handoff = clean_latency(&hist);
+    return results;
+}
+
+// Producer/consumer on every pair of `pairs`, fixed (32 bytes) and variable
+// (8 to 256 bytes) records, through a locked ByteBuffer, a locked CByteBuffer
+// and a CSpscByteBuffer.
+void producer_consumer_benchmark(const std::vector<core_pair> &pairs) {
+    size_t bytes = 64*4096;
+    size_t items = 1 << 20;
+    size_t iter = 5;
+
+    std::vector<uint32_t> fixed_sizes = {32};
+    std::vector<uint32_t> variable_sizes(4096);
+    uint64_t x = 88172645463325252ull;
+    for (auto &size : variable_sizes)
+    {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        size = 8 + x % 249;
+    }
+    const std::vector<uint32_t> *record_sizes[2] = {&fixed_sizes, &variable_sizes};
+    const char *record_names[2] = {"fixed", "variable"};
+
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+
+    std::vector<std::string> rows;
+    for (const core_pair &pair : pairs)
+    {
+        for (int r = 0; r < 2; ++r)
+        {
+            printf("\nProducer/consumer %s, %s records, cpu %d -> cpu %d\n",
+                   pair.name, record_names[r], pair.producer_cpu, pair.consumer_cpu);
+
+            ByteBuffer buf(bytes);
+            locked_records<ByteBuffer> buf_records{&buf, bytes};
+            printf("  Locked Buffer:\n");
+            handoff_results buf_results = bench_handoff(&buf_records, pair, *record_sizes[r], items, iter);
+
+            CByteBuffer cbuf(bytes, options);
+            locked_records<CByteBuffer> cbuf_records{&cbuf, cbuf.PSize};
+            printf("  Locked CBuffer:\n");
+            handoff_results cbuf_results = bench_handoff(&cbuf_records, pair, *record_sizes[r], items, iter);
+
+            CSpscByteBuffer qbuf(bytes);
+            spsc_records qbuf_records{&qbuf};
+            printf("  SPSC CBuffer:\n");
+            handoff_results qbuf_results = bench_handoff(&qbuf_records, pair, *record_sizes[r], items, iter);
+
+            char row[512];
+            snprintf(row, sizeof(row), "%s,%s,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+                     pair.name, record_names[r],
+                     buf_results.metric, buf_results.handoff.p50, buf_results.handoff.p99,
+                     cbuf_results.metric, cbuf_results.handoff.p50, cbuf_results.handoff.p99,
+                     qbuf_results.metric, qbuf_results.handoff.p50, qbuf_results.handoff.p99);
+            rows.push_back(row);
+        }
+    }
+
+    printf("pair,records,buf_thru,buf_handoff_p50,buf_handoff_p99,cbuf_thru,cbuf_handoff_p50,cbuf_handoff_p99,spsc_thru,spsc_handoff_p50,spsc_handoff_p99\n");
+    for (auto &row : rows) printf("%s\n", row.c_str());
+}
+
+// Pushes `ops` records of `record` bytes into a full ring, over and over:
+// CLossyByteBuffer (framing, drops the oldest whole records) against an
+// unchecked CByteBuffer::PushN (clobbers) and a plain memcpy into a flat buffer.
+//
+// Fills `results` with memcpy, CByteBuffer and CLossyByteBuffer, in that order.
+//
+// `iter` how many iterations
+// `count` is length of buffer (bytes)
+void bench_lossy_byte(CLossyByteBuffer* lbuf, CByteBuffer* cbuf, size_t count, size_t record, size_t ops, size_t iter,
+                      bench_results results[3])
+{
+    std::vector<std::byte> src(record, std::byte(7));
+    std::vector<std::byte> flat(count);
+
+    printf("\nLossy push, buffer size: %ld, record size: %ld\n", count, record);
+    bench_results bench_results_buf = bench(iter, [&]() {
+        size_t offset = 0;
+        for (size_t i = 0; i < ops; ++i)
+        {
+            if (offset + record > count) offset = 0;
+            std::memcpy(&flat[offset], src.data(), record);
+            offset += record;
+        }
+        KEEP_ALIVE(flat.data());
+    }, [&](){});
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            cbuf->PushN(src.data(), record);
+        }
+        KEEP_ALIVE(cbuf->Data);
+    }, [&](){ cbuf->Reset(); });
+
+    bench_results bench_results_lbuf = bench(iter, [&]() {
+        for (size_t i = 0; i < ops; ++i)
+        {
+            lbuf->Push(src.data(), record);
+        }
+        KEEP_ALIVE(lbuf->Data);
+    }, [&](){ lbuf->Reset(); });
+
+    printf("  memcpy best run:\n");
+    clean_results(&bench_results_buf, (double)record * ops);
+    printf("  CByteBuffer best run:\n");
+    clean_results(&bench_results_cbuf, (double)record * ops);
+    printf("  CLossyByteBuffer best run:\n");
+    clean_results(&bench_results_lbuf, (double)record * ops);
+    results[0] = bench_results_buf;
+    results[1] = bench_results_cbuf;
+    results[2] = bench_results_lbuf;
+}
+
+// Overwrite-oldest push speed against unchecked pushes, by record size
+void lossy_benchmark() {
+    int i;
+    int loops = 4;
+    size_t records[4] = {16, 64, 256, 1024};
+    size_t bytes = 16*4096;
+    size_t iter = 20;
+
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+    CLossyByteBuffer lbuf(bytes);
+    CByteBuffer cbuf(bytes, options);
+
+    bench_results bench_results_metrics[3*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        size_t ops = 64 * bytes / records[i];
+        bench_lossy_byte(&lbuf, &cbuf, bytes, records[i], ops, iter, &bench_results_metrics[3*i]);
+    }
+
+    printf("record,memcpy_push,cbuf_push,lossy_push,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,%lf,\n", records[i],
+            bench_results_metrics[0+3*i].metric, bench_results_metrics[1+3*i].metric,
+            bench_results_metrics[2+3*i].metric
+        );
+    }
+}
+
+// Message sizes drawn from `dist`: "small" (16 to 64 bytes), "mixed" (90% 32 to 128,
+// 10% 512 to 1500, like a packet trace) or "large" (log uniform, 64 to 4096)
+std::vector<uint32_t> message_sizes(const char *dist, size_t count)
+{
+    std::vector<uint32_t> sizes(count);
+    uint64_t x = 88172645463325252ull;
+    for (auto &size : sizes)
+    {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        if (strcmp(dist, "small") == 0) size = 16 + x % 49;
+        else if (strcmp(dist, "mixed") == 0) size = (x >> 32) % 10 ? 32 + x % 97 : 512 + x % 989;
+        else size = 64u << (x % 7) | (uint32_t)((x >> 8) % 64);
+    }
+    return sizes;
+}
+
+// Streams variable size messages through the buffers, `batch` pushes then
+// `batch` pops, the consumer reading the first 8 bytes of every payload.
+// ByteBuffer: hand rolled header + payload, copied out (it may be split).
+// CByteBuffer: PushMessage / PeekMessage in place, and PeekMessages batches.
+// Fills `results` with ByteBuffer, CByteBuffer one by one, CByteBuffer batched.
+//
+// `iter` how many iterations
+void bench_message_byte(ByteBuffer* buf, CByteBuffer* cbuf, const std::vector<uint32_t> &sizes, size_t batch,
+                        size_t iter, bench_results results[3])
+{
+    size_t total_bytes = 0;
+    for (uint32_t size : sizes) total_bytes += size;
+    std::vector<std::byte> src(4096 + 64, std::byte(3));
+    std::vector<std::byte> scratch(4096 + 64);
+
+    bench_results bench_results_buf = bench(iter, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < sizes.size(); i += batch)
+        {
+            for (size_t j = i; j < i + batch; ++j)
+            {
+                buf->Push(sizes[j]);
+                buf->PushN(src.data(), sizes[j]);
+            }
+            for (size_t j = i; j < i + batch; ++j)
+            {
+                uint32_t size = buf->Pop<uint32_t>();
+                buf->PopN(scratch.data(), size);
+                uint64_t v;
+                std::memcpy(&v, scratch.data(), sizeof(v));
+                sum += v;
+            }
+        }
+        KEEP_ALIVE(sum);
+    }, [&](){ buf->Reset(); });
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < sizes.size(); i += batch)
+        {
+            for (size_t j = i; j < i + batch; ++j)
+            {
+                cbuf->PushMessage(std::span<const std::byte>(src.data(), sizes[j]));
+            }
+            for (size_t j = i; j < i + batch; ++j)
+            {
+                uint64_t v;
+                std::memcpy(&v, cbuf->PeekMessage().data(), sizeof(v));
+                sum += v;
+                cbuf->PopMessage();
+            }
+        }
+        KEEP_ALIVE(sum);
+    }, [&](){ cbuf->Reset(); });
+
+    bench_results bench_results_batch = bench(iter, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < sizes.size(); i += batch)
+        {
+            for (size_t j = i; j < i + batch; ++j)
+            {
+                cbuf->PushMessage(std::span<const std::byte>(src.data(), sizes[j]));
+            }
+            CMessageBatch<8> messages = cbuf->PeekMessages(batch);
+            for (std::span<const std::byte> message : messages)
+            {
+                uint64_t v;
+                std::memcpy(&v, message.data(), sizeof(v));
+                sum += v;
+            }
+            cbuf->Consume(messages.GetBytes());
+        }
+        KEEP_ALIVE(sum);
+    }, [&](){ cbuf->Reset(); });
+
+    printf("  Buffer best run:\n");
+    clean_results(&bench_results_buf, (double)total_bytes);
+    printf("  CBuffer best run:\n");
+    clean_results(&bench_results_cbuf, (double)total_bytes);
+    printf("  CBuffer batched best run:\n");
+    clean_results(&bench_results_batch, (double)total_bytes);
+    results[0] = bench_results_buf;
+    results[1] = bench_results_cbuf;
+    results[2] = bench_results_batch;
+}
+
+// Framed variable size messages over realistic size distributions
+void message_benchmark() {
+    int i;
+    int loops = 3;
+    const char *dists[3] = {"small", "mixed", "large"};
+    size_t bytes = 64*4096;
+    size_t batch = 16;
+    size_t count = 1 << 18;
+    size_t iter = 10;
+
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+    ByteBuffer buf(bytes);
+    CByteBuffer cbuf(bytes, options);
+
+    bench_results bench_results_metrics[3*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        printf("\nMessages, %s sizes, buffer size: %ld\n", dists[i], bytes);
+        bench_message_byte(&buf, &cbuf, message_sizes(dists[i], count), batch, iter, &bench_results_metrics[3*i]);
+    }
+
+    printf("sizes,buf_msg,cbuf_msg,cbuf_msg_batch,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%s,%lf,%lf,%lf,\n", dists[i],
+            bench_results_metrics[0+3*i].metric, bench_results_metrics[1+3*i].metric,
+            bench_results_metrics[2+3*i].metric
+        );
+    }
+}
+
+// Compile time against runtime capacity of `N` bytes: wraparound Push / Pop of
+// ByteBuffer and StaticByteBuffer<N>, and indexed writes (2 laps) of
+// Buffer<uint32_t> and StaticBuffer<uint32_t, N/4>.
+// Fills `results` with buf_wrap_w, sbuf_wrap_w, buf_wrap_r, sbuf_wrap_r, buf_index_w, sbuf_index_w.
+//
+// `iter` how many iterations
+template <size_t N>
+void bench_static_byte(size_t iter, bench_results results[6])
+{
+    ByteBuffer buf(N);
+    StaticByteBuffer<N> sbuf;
+    Buffer<uint32_t> tbuf(N / sizeof(uint32_t));
+    StaticBuffer<uint32_t, N / sizeof(uint32_t)> stbuf;
+    size_t items = 2 * N / sizeof(SomeData);
+    size_t count = 2 * N / sizeof(uint32_t);
+    size_t expected_sum = items * tmp_.d;
+
+    printf("\nStatic capacity, buffer size: %ld\n", N);
+    results[0] = bench(iter, [&]() {
+        for (size_t i = 0; i < items; ++i) buf.Push(tmp_);
+        KEEP_ALIVE(buf.Data);
+    }, [&](){ buf.Reset(); });
+    results[1] = bench(iter, [&]() {
+        for (size_t i = 0; i < items; ++i) sbuf.Push(tmp_);
+        KEEP_ALIVE(sbuf.Data);
+    }, [&](){ sbuf.Reset(); });
+
+    results[2] = bench(iter, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < items; ++i) sum += buf.template Pop<SomeData>().d;
+        KEEP_ALIVE(sum);
+        assert(expected_sum == sum);
+    }, [&](){ buf.Reset(); });
+    results[3] = bench(iter, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < items; ++i) sum += sbuf.template Pop<SomeData>().d;
+        KEEP_ALIVE(sum);
+        assert(expected_sum == sum);
+    }, [&](){ sbuf.Reset(); });
+
+    results[4] = bench(iter, [&]() {
+        for (size_t i = 0; i < count; ++i) tbuf[i] = i;
+        KEEP_ALIVE(tbuf.Data);
+    }, [&](){});
+    results[5] = bench(iter, [&]() {
+        for (size_t i = 0; i < count; ++i) stbuf[i] = i;
+        KEEP_ALIVE(stbuf.Data);
+    }, [&](){});
+
+    const char *names[6] = {"Buffer wraparound write", "StaticBuffer wraparound write",
+                            "Buffer wraparound read", "StaticBuffer wraparound read",
+                            "Buffer<T> indexed write", "StaticBuffer<T> indexed write"};
+    for (int t = 0; t < 6; ++t)
+    {
+        printf("  %s best run:\n", names[t]);
+        clean_results(&results[t], t < 4 ? (double)items * sizeof(SomeData) : (double)count * sizeof(uint32_t));
+    }
+}
+
+// StaticBuffer / StaticByteBuffer against Buffer / ByteBuffer, sizes of byte_buffer_benchmark()
+void static_buffer_benchmark() {
+    int i;
+    int tests = 6;
+    int loops = 7; //   4k    64k      512k      4m         8m         16m        256m
+    size_t bytes[7] = {4096, 16*4096, 128*4096, 1024*4096 , 2048*4096, 4096*4096, 16*4096*4096};
+    size_t iters[7] = {100000, 10000,  1000,     100       , 100,         50,       10};
+
+    bench_results bench_results_metrics[tests*loops];
+    bench_static_byte<4096>(iters[0], &bench_results_metrics[0*tests]);
+    bench_static_byte<16*4096>(iters[1], &bench_results_metrics[1*tests]);
+    bench_static_byte<128*4096>(iters[2], &bench_results_metrics[2*tests]);
+    bench_static_byte<1024*4096>(iters[3], &bench_results_metrics[3*tests]);
+    bench_static_byte<2048*4096>(iters[4], &bench_results_metrics[4*tests]);
+    bench_static_byte<4096*4096>(iters[5], &bench_results_metrics[5*tests]);
+    bench_static_byte<16*4096*4096>(iters[6], &bench_results_metrics[6*tests]);
+
+    printf("bytes,buf_wrap_w,sbuf_wrap_w,buf_wrap_r,sbuf_wrap_r,buf_index_w,sbuf_index_w\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld", bytes[i]);
+        for (int t = 0; t < tests; ++t) printf(",%lf", bench_results_metrics[t+tests*i].metric);
+        printf("\n");
+    }
+}
+
+struct wait_results
+{
+    latency_results handoff; // producer push to consumer pop
+    double cpu_pct;          // consumer CPU time over wall time
+};
+
+double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The producer pushes `items` timestamps, one every `gap_us` microseconds
+// (mostly idle), the consumer waits for each one with the strategy `W`.
+// Reports the handoff latency and how busy the waiting consumer was.
+template <typename W>
+wait_results bench_wait_strategy(CSpscByteBuffer* qbuf, int producer_cpu, int consumer_cpu, size_t items, long gap_us)
+{
+    latency_histogram hist;
+    double cpu_seconds = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread consumer([&]() {
+        pin_thread(consumer_cpu);
+        double cpu_start = thread_cpu_seconds();
+        for (size_t i = 0; i < items; ++i)
+        {
+            uint64_t tsc = qbuf->Pop<uint64_t, W>();
+            hist.record(__rdtsc() - tsc);
+        }
+        cpu_seconds = thread_cpu_seconds() - cpu_start;
+    });
+    // a thread of its own: pinning the caller would pin every later benchmark
+    std::thread producer([&]() {
+        pin_thread(producer_cpu);
+        for (size_t i = 0; i < items; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(gap_us));
+            qbuf->Push<W>((uint64_t)__rdtsc());
+        }
+    });
+    producer.join();
+    consumer.join();
+
+    double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    wait_results results;
+    results.handoff = clean_latency(&hist);
+    results.cpu_pct = 100.0 * cpu_seconds / wall_seconds;
+    printf("    Consumer CPU: %.1f%%\n", results.cpu_pct);
+    return results;
+}
+
+// Busy-spin, spin-then-futex and futex waits, on a mostly idle stream:
+// handoff latency against the CPU the consumer burns while waiting
+void wait_strategy_benchmark() {
+    size_t items = 20000;
+    long gap_us = 20;
+    int producer_cpu = 0;
+    int consumer_cpu = std::thread::hardware_concurrency() > 1 ? 1 : 0;
+    CSpscByteBuffer qbuf(4096);
+
+    const char *names[3] = {"spin", "spin_futex", "futex"};
+    wait_results results[3];
+    printf("\nWait strategies, cpu %d -> cpu %d, one item every %ld us\n", producer_cpu, consumer_cpu, gap_us);
+    printf("  %s:\n", names[0]);
+    results[0] = bench_wait_strategy<SpinWait>(&qbuf, producer_cpu, consumer_cpu, items, gap_us);
+    printf("  %s:\n", names[1]);
+    results[1] = bench_wait_strategy<SpinFutexWait>(&qbuf, producer_cpu, consumer_cpu, items, gap_us);
+    printf("  %s:\n", names[2]);
+    results[2] = bench_wait_strategy<FutexWait>(&qbuf, producer_cpu, consumer_cpu, items, gap_us);
+
+    printf("strategy,handoff_p50,handoff_p99,handoff_p999,consumer_cpu_pct\n");
+    for (int i = 0; i < 3; ++i) {
+        printf("%s,%lf,%lf,%lf,%lf\n", names[i],
+            results[i].handoff.p50, results[i].handoff.p99, results[i].handoff.p999, results[i].cpu_pct);
+    }
+}
+
+// Reduces `windows` windows of `window` floats, at tails spread over the buffer
+// (many across its end): a masking loop over Buffer against the vector kernels
+// over CBuffer, sum and max. Then the same samples through a CRollingWindow,
+// one Push and Sum per sample.
+//
+// `count` is length of buffers (items)
+void bench_window_typed(Buffer<float>* buf, CBuffer<float>* cbuf, size_t count, size_t window, size_t windows,
+                        size_t iter, bench_results results[5])
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        (*buf)[i] = (*cbuf)[i] = static_cast<float>(i % 251);
+    }
+    size_t stride = 4099; // prime: tails land everywhere, including right before the end
+
+    printf("\nWindow reductions, buffer size: %ld, window: %ld\n", count, window);
+    bench_results bench_results_buf_sum = bench(iter, [&]() {
+        float total = 0;
+        for (size_t w = 0; w < windows; ++w)
+        {
+            size_t tail = w * stride % count;
+            float sum = 0;
+            for (size_t i = 0; i < window; ++i)
+            {
+                sum += (*buf)[tail + i];
+            }
+            total += sum;
+        }
+        KEEP_ALIVE(total);
+    }, [&](){});
+
+    bench_results bench_results_cbuf_sum = bench(iter, [&]() {
+        float total = 0;
+        for (size_t w = 0; w < windows; ++w)
+        {
+            total += WindowSum(*cbuf, w * stride, window);
+        }
+        KEEP_ALIVE(total);
+    }, [&](){});
+
+    bench_results bench_results_buf_max = bench(iter, [&]() {
+        float total = 0;
+        for (size_t w = 0; w < windows; ++w)
+        {
+            size_t tail = w * stride % count;
+            float max = (*buf)[tail];
+            for (size_t i = 1; i < window; ++i)
+            {
+                float x = (*buf)[tail + i];
+                max = x > max ? x : max;
+            }
+            total += max;
+        }
+        KEEP_ALIVE(total);
+    }, [&](){});
+
+    bench_results bench_results_cbuf_max = bench(iter, [&]() {
+        float total = 0;
+        for (size_t w = 0; w < windows; ++w)
+        {
+            total += WindowMax(*cbuf, w * stride, window);
+        }
+        KEEP_ALIVE(total);
+    }, [&](){});
+
+    CRollingWindow<float> rolling(window);
+    size_t samples = windows * 64;
+    bench_results bench_results_rolling = bench(iter, [&]() {
+        float total = 0;
+        for (size_t i = 0; i < samples; ++i)
+        {
+            rolling.Push(static_cast<float>(i % 251));
+            total += rolling.Sum();
+        }
+        KEEP_ALIVE(total);
+    }, [&](){ rolling.Reset(); });
+
+    double bytes = (double)sizeof(float) * window * windows;
+    printf("  Buffer sum best run:\n");
+    clean_results(&bench_results_buf_sum, bytes);
+    printf("  CBuffer WindowSum best run:\n");
+    clean_results(&bench_results_cbuf_sum, bytes);
+    printf("  Buffer max best run:\n");
+    clean_results(&bench_results_buf_max, bytes);
+    printf("  CBuffer WindowMax best run:\n");
+    clean_results(&bench_results_cbuf_max, bytes);
+    printf("  CRollingWindow Push + Sum best run:\n");
+    clean_results(&bench_results_rolling, (double)sizeof(float) * samples);
+    results[0] = bench_results_buf_sum;
+    results[1] = bench_results_cbuf_sum;
+    results[2] = bench_results_buf_max;
+    results[3] = bench_results_cbuf_max;
+    results[4] = bench_results_rolling;
+}
+
+// Sliding window sum and max, masked loops against the mirrored vector kernels, by window length
+void window_benchmark() {
+    int i;
+    int loops = 5;
+    size_t windows[5] = {16, 64, 256, 1024, 8192};
+    size_t count = 4*4096; // 64k of floats
+    size_t iter = 20;
+
+    Buffer<float> buf(count);
+    CBuffer<float> cbuf(count * sizeof(float));
+
+    bench_results bench_results_metrics[5*loops];
+    for (i = 0; i < loops; ++i)
+    {
+        size_t reductions = (1 << 22) / windows[i];
+        bench_window_typed(&buf, &cbuf, count, windows[i], reductions, iter, &bench_results_metrics[5*i]);
+    }
+
+    printf("window,buf_sum,cbuf_sum,buf_max,cbuf_max,rolling_push,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,%lf,%lf,%lf,\n", windows[i],
+            bench_results_metrics[0+5*i].metric, bench_results_metrics[1+5*i].metric,
+            bench_results_metrics[2+5*i].metric, bench_results_metrics[3+5*i].metric,
+            bench_results_metrics[4+5*i].metric
+        );
+    }
+}
+
+// 24 bytes: does not divide PSize, so records straddle every view boundary
+struct SoakRecord
+{
+    uint64_t seq;
+    uint64_t check;
+    uint64_t pad;
+};
+
+// Pushes and pops `records` 24 byte records, 64 at a time, checking every one.
+// Head and Tail rebase at WrapSize every lap of the virtual buffer: a slow or
+// split path there shows as a cliff against a run that never gets to it.
+// Bad records of all runs go to `errors`.
+bench_results bench_soak_byte(CByteBuffer* cbuf, size_t records, size_t iter, uint64_t* errors)
+{
+    size_t batch = 64;
+    *errors = 0;
+
+    bench_results bench_results_cbuf = bench(iter, [&]() {
+        uint64_t pushed = 0, popped = 0;
+        while (popped < records)
+        {
+            for (size_t i = 0; i < batch; ++i, ++pushed)
+            {
+                cbuf->Push(SoakRecord{pushed, ~pushed, 0});
+            }
+            for (size_t i = 0; i < batch; ++i, ++popped)
+            {
+                SoakRecord r = cbuf->Pop<SoakRecord>();
+                *errors += r.seq != popped || r.check != ~popped;
+            }
+        }
+        KEEP_ALIVE(*errors);
+    }, [&](){ cbuf->Reset(); });
+
+    clean_results(&bench_results_cbuf, 2.0 * sizeof(SoakRecord) * records);
+    if (*errors) printf("    CORRUPTED: %ld bad records\n", *errors);
+    return bench_results_cbuf;
+}
+
+// Soak far past the virtual buffer: throughput by laps of it, from a run that
+// stays below WrapSize (0 laps) to thousands of index rebases
+void soak_benchmark() {
+    int i;
+    int loops = 5;
+    double laps[5] = {0.5, 1, 16, 256, 4096};
+    size_t bytes = 4096;
+    uint8_t views = 16; // 64k virtual buffer, rebased every 60k
+    size_t iter = 10;
+
+    CByteBuffer cbuf(bytes, views);
+    bench_results bench_results_metrics[loops];
+    uint64_t errors[loops];
+    for (i = 0; i < loops; ++i)
+    {
+        size_t records = (size_t)(laps[i] * cbuf.WrapSize / sizeof(SoakRecord)) / 64 * 64;
+        printf("\nSoak, virtual size: %ld, laps: %.1f\n", cbuf.VSize, laps[i]);
+        printf("  CByteBuffer best run:\n");
+        bench_results_metrics[i] = bench_soak_byte(&cbuf, records, iter, &errors[i]);
+    }
+
+    printf("laps,cbuf_soak,errors,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%.1f,%lf,%ld,\n", laps[i],
+            bench_results_metrics[i].metric, errors[i]
+        );
+    }
+}
+
+template <size_t N>
+struct SweepRecord
+{
+    uint8_t bytes[N];
+};
+
+// Fills the buffer with N byte records, then pops them all, touching a byte
+// of each: Push / Pop against PushAligned / PopAligned (cache line), each
+// without and with a prefetch distance. The buffer is bigger than the last
+// level cache, so pops run into the oldest records, long evicted.
+//
+// `iter` how many iterations
+template <size_t N>
+void bench_record_sweep_byte(CByteBuffer* cbuf, size_t distance, size_t iter, bench_results results[4])
+{
+    SweepRecord<N> record;
+    std::memset(record.bytes, 1, N);
+    size_t padded = (N + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+    printf("\nRecord sweep, record size: %ld\n", N);
+    for (int r = 0; r < 4; ++r)
+    {
+        bool aligned = r & 1;
+        size_t count = cbuf->PSize / (aligned ? padded : N);
+        cbuf->PrefetchDistance = r & 2 ? distance : 0;
+
+        results[r] = bench(iter, [&]() {
+            uint64_t sum = 0;
+            if (aligned)
+            {
+                for (size_t i = 0; i < count; ++i) sum += cbuf->PopAligned<SweepRecord<N>>().bytes[0];
+            }
+            else
+            {
+                for (size_t i = 0; i < count; ++i) sum += cbuf->Pop<SweepRecord<N>>().bytes[0];
+            }
+            KEEP_ALIVE(sum);
+            assert(sum == count);
+        }, [&](){
+            cbuf->Reset();
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (aligned) cbuf->PushAligned(record);
+                else cbuf->Push(record);
+            }
+        });
+
+        printf("  %s pops, prefetch distance %ld, best run:\n", aligned ? "Aligned" : "Packed", cbuf->PrefetchDistance);
+        clean_results(&results[r], (double)N * count);
+    }
+    cbuf->PrefetchDistance = 0;
+}
+
+template <size_t... Sizes>
+void record_sweep(CByteBuffer* cbuf, size_t distance, size_t iter)
+{
+    const size_t sizes[] = {Sizes...};
+    const size_t loops = sizeof...(Sizes);
+    bench_results bench_results_metrics[loops][4];
+    size_t i = 0;
+    (bench_record_sweep_byte<Sizes>(cbuf, distance, iter, bench_results_metrics[i++]), ...);
+
+    printf("record,packed,aligned,packed_prefetch,aligned_prefetch,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,%lf,%lf,\n", sizes[i],
+            bench_results_metrics[i][0].metric, bench_results_metrics[i][1].metric,
+            bench_results_metrics[i][2].metric, bench_results_metrics[i][3].metric
+        );
+    }
+}
+
+// Pop heavy consumers, by record size (1 to 256 bytes): packed against cache
+// line aligned records, without and with software prefetching
+void record_alignment_benchmark() {
+    CByteBuffer cbuf(16 << 20, (uint8_t)2); // past the last level cache
+    size_t distance = 512; // 8 cache lines ahead of Tail
+    record_sweep<1, 2, 3, 4, 7, 8, 12, 16, 24, 31, 32, 48, 63, 64, 96, 100, 128, 192, 200, 256>(&cbuf, distance, 5);
+}
+
+// A market data sample, packed as rows (AoS)
+struct TickRow
+{
+    uint64_t stamp;
+    double price;
+    uint32_t qty;
+    uint8_t flags;
+};
+
+// Sums the price of `rows` ticks: a strided loop over TickRows pushed into a
+// CByteBuffer, against a loop and WindowSum over the price column of a
+// CColumnBuffer. Throughput counts the prices only, the bytes a reader wants.
+void bench_column_scan(CByteBuffer* cbuf, CColumnBuffer<uint64_t, double, uint32_t, uint8_t>* columns,
+                       size_t rows, size_t iter, bench_results results[3])
+{
+    cbuf->Reset();
+    columns->Reset();
+    for (size_t i = 0; i < rows; ++i)
+    {
+        TickRow row{i, (i % 251) * 0.25, static_cast<uint32_t>(i), static_cast<uint8_t>(i)};
+        cbuf->Push(row);
+        columns->TryPush(row.stamp, row.price, row.qty, row.flags);
+    }
+
+    printf("\nColumn scan, rows: %ld\n", rows);
+    results[0] = bench(iter, [&]() {
+        const TickRow* data = reinterpret_cast<const TickRow*>(&cbuf->Data[cbuf->Tail]);
+        double sum = 0;
+        for (size_t i = 0; i < rows; ++i) sum += data[i].price;
+        KEEP_ALIVE(sum);
+    }, [&](){});
+    printf("  Rows (CByteBuffer) best run:\n");
+    clean_results(&results[0], sizeof(double) * rows);
+
+    results[1] = bench(iter, [&]() {
+        double sum = 0;
+        for (double price : columns->Column<1>()) sum += price;
+        KEEP_ALIVE(sum);
+    }, [&](){});
+    printf("  Column loop best run:\n");
+    clean_results(&results[1], sizeof(double) * rows);
+
+    results[2] = bench(iter, [&]() {
+        double sum = WindowSum(columns->GetBuffer<1>(), columns->Tail, columns->GetSize());
+        KEEP_ALIVE(sum);
+    }, [&](){});
+    printf("  Column WindowSum best run:\n");
+    clean_results(&results[2], sizeof(double) * rows);
+}
+
+// Scanning one field: rows against columns, by row count
+void column_benchmark() {
+    size_t i;
+    const size_t loops = 4;
+    size_t rows[loops] = {4096, 1 << 14, 1 << 17, 1 << 20};
+    bench_results bench_results_metrics[loops][3];
+
+    CByteBuffer cbuf(sizeof(TickRow) * rows[loops - 1]);
+    CColumnBuffer<uint64_t, double, uint32_t, uint8_t> columns(rows[loops - 1]);
+    for (i = 0; i < loops; ++i)
+    {
+        bench_column_scan(&cbuf, &columns, rows[i], 20, bench_results_metrics[i]);
+    }
+
+    printf("rows,row_loop,column_loop,column_window_sum,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,%lf,\n", rows[i],
+            bench_results_metrics[i][0].metric, bench_results_metrics[i][1].metric, bench_results_metrics[i][2].metric
+        );
+    }
+}
+
+// Appends 64 flushes worth of 64 byte records, `batch` records per flush:
+// fwrite, then fflush + fdatasync, against TryPush, then Flush() on a
+// CJournalByteBuffer that is consumed (checkpointed) after every flush.
+// Both files live in the current directory.
+void bench_journal_byte(size_t batch, size_t iter, bench_results results[2])
+{
+    struct JournalRecord
+    {
+        uint64_t seq;
+        uint8_t payload[56];
+    };
+    const size_t flushes = 64;
+    const size_t records = flushes * batch;
+    JournalRecord record;
+    std::memset(&record, 7, sizeof(record));
+
+    printf("\nJournal, records per flush: %ld\n", batch);
+    FILE* file = nullptr;
+    results[0] = bench(iter, [&]() {
+        for (size_t f = 0; f < flushes; ++f)
+        {
+            for (size_t i = 0; i < batch; ++i)
+            {
+                record.seq = f * batch + i;
+                fwrite(&record, sizeof(record), 1, file);
+            }
+            fflush(file);
+            fdatasync(fileno(file));
+        }
+    }, [&](){
+        if (file) fclose(file);
+        file = fopen("bench_journal.stdio", "w");
+    });
+    fclose(file);
+    unlink("bench_journal.stdio");
+    printf("  fwrite + fdatasync best run:\n");
+    clean_results(&results[0], (double)sizeof(record) * records);
+
+    unlink("bench_journal.ring");
+    CJournalByteBuffer journal = CJournalByteBuffer::Open("bench_journal.ring", sizeof(record) * batch);
+    results[1] = bench(iter, [&]() {
+        for (size_t f = 0; f < flushes; ++f)
+        {
+            for (size_t i = 0; i < batch; ++i)
+            {
+                record.seq = f * batch + i;
+                journal.TryPush(record);
+            }
+            journal.Flush();
+            journal.Consume(journal.GetUsed());
+        }
+    }, [&](){});
+    unlink("bench_journal.ring");
+    printf("  CJournalByteBuffer best run:\n");
+    clean_results(&results[1], (double)sizeof(record) * records);
+}
+
+// Durable appends: stdio journal against the mmap'd one, by flush batch
+void journal_benchmark() {
+    size_t i;
+    const size_t loops = 4;
+    size_t batches[loops] = {1, 16, 256, 4096};
+    bench_results bench_results_metrics[loops][2];
+    for (i = 0; i < loops; ++i)
+    {
+        bench_journal_byte(batches[i], 5, bench_results_metrics[i]);
+    }
+
+    printf("batch,fwrite_fdatasync,journal_flush,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,\n", batches[i], bench_results_metrics[i][0].metric, bench_results_metrics[i][1].metric);
+    }
+}
+
+struct FanoutRecord
+{
+    uint64_t seq;
+    uint8_t payload[56];
+};
+
+// Fans `items` 64 byte records out from one producer to `readers` reader
+// threads: a CSpscByteBuffer per reader (the producer pushes every record
+// `readers` times), against one CBroadcastByteBuffer, then a lossy one, which
+// never waits for slow readers. Bytes lapped readers skipped go to `lost`.
+//
+// `iter` how many iterations
+void bench_broadcast_byte(int readers, size_t items, size_t iter, bench_results results[3], uint64_t* lost)
+{
+    const size_t size = 64 * 1024;
+    FanoutRecord record;
+    std::memset(&record, 3, sizeof(record));
+
+    printf("\nBroadcast, readers: %d\n", readers);
+    std::vector<std::unique_ptr<CSpscByteBuffer>> queues;
+    for (int r = 0; r < readers; ++r) queues.emplace_back(new CSpscByteBuffer(size));
+    results[0] = bench(iter, [&]() {
+        std::vector<std::thread> threads;
+        for (int r = 0; r < readers; ++r)
+        {
+            threads.emplace_back([&, r]() {
+                FanoutRecord in;
+                uint64_t sum = 0;
+                for (size_t i = 0; i < items; ++i)
+                {
+                    while (!queues[r]->TryPop(in)) std::this_thread::yield();
+                    sum += in.seq;
+                }
+                KEEP_ALIVE(sum);
+            });
+        }
+        for (size_t i = 0; i < items; ++i)
+        {
+            record.seq = i;
+            for (int r = 0; r < readers; ++r)
+            {
+                while (!queues[r]->TryPush(record)) std::this_thread::yield();
+            }
+        }
+        for (auto &t : threads) t.join();
+    }, [&](){ for (auto &q : queues) q->Reset(); });
+    printf("  CSpscByteBuffer per reader best run:\n");
+    clean_results(&results[0], (double)sizeof(record) * items);
+
+    for (int lossy = 0; lossy < 2; ++lossy)
+    {
+        CBroadcastByteBuffer ring(size, readers, lossy);
+        std::atomic<bool> done(false);
+        results[1 + lossy] = bench(iter, [&]() {
+            std::vector<std::thread> threads;
+            for (int r = 0; r < readers; ++r)
+            {
+                threads.emplace_back([&, r]() {
+                    FanoutRecord in;
+                    uint64_t sum = 0;
+                    for (;;)
+                    {
+                        if (ring.TryPop(r, in))
+                        {
+                            sum += in.seq;
+                            if (in.seq == items - 1) break;
+                        }
+                        else if (ring.IsLapped(r))
+                        {
+                            ring.Resync(r);
+                        }
+                        else if (done.load(std::memory_order_acquire) && ring.GetPoppable(r) == 0)
+                        {
+                            break; // lapped past the last record
+                        }
+                        else
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                    KEEP_ALIVE(sum);
+                });
+            }
+            for (size_t i = 0; i < items; ++i)
+            {
+                record.seq = i;
+                while (!ring.TryPush(record)) std::this_thread::yield();
+            }
+            done.store(true, std::memory_order_release);
+            for (auto &t : threads) t.join();
+        }, [&](){ ring.Reset(); done.store(false); });
+        printf("  CBroadcastByteBuffer%s best run:\n", lossy ? " (lossy)" : "");
+        clean_results(&results[1 + lossy], (double)sizeof(record) * items);
+
+        if (lossy)
+        {
+            *lost = 0;
+            for (int r = 0; r < readers; ++r) *lost += ring.Cursors[r].Lost;
+        }
+    }
+}
+
+// Market data fanout, by reader count: a copy per reader against one broadcast ring
+void broadcast_benchmark() {
+    int i;
+    const int loops = 6;
+    int readers[loops] = {1, 2, 4, 8, 16, 32};
+    size_t items = 1 << 17;
+    bench_results bench_results_metrics[loops][3];
+    uint64_t lost[loops];
+    for (i = 0; i < loops; ++i)
+    {
+        bench_broadcast_byte(readers[i], items, 5, bench_results_metrics[i], &lost[i]);
+    }
+
+    printf("readers,spsc_per_reader,broadcast,broadcast_lossy,lossy_lost_bytes,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%d,%lf,%lf,%lf,%ld,\n", readers[i],
+            bench_results_metrics[i][0].metric, bench_results_metrics[i][1].metric,
+            bench_results_metrics[i][2].metric, lost[i]
+        );
+    }
+}
+
+// Moves 64MB from one CSpscByteBuffer to another, `chunk` bytes at a time,
+// through a byte transform (xor with a key, standing in for a compressor):
+// pop into a scratch buffer, transform into a second one and push it, against
+// a CPipelineStage that transforms from one ring into the other in place.
+// Single threaded, to count the copies and nothing else.
+//
+// `iter` how many iterations
+void bench_pipeline_byte(size_t chunk, size_t iter, bench_results results[2])
+{
+    const size_t total = 64 << 20;
+    const size_t steps = total / chunk;
+    CSpscByteBuffer input(1 << 20), output(1 << 20);
+    std::vector<std::byte> scratch_in(chunk), scratch_out(chunk);
+    auto transform = [](const std::byte* in, std::byte* out, size_t n) {
+        for (size_t i = 0; i < n; ++i) out[i] = in[i] ^ std::byte{0x5a};
+    };
+
+    printf("\nPipeline stage, chunk: %ld\n", chunk);
+    results[0] = bench(iter, [&]() {
+        for (size_t s = 0; s < steps; ++s)
+        {
+            input.Commit(chunk); // contents do not matter
+            input.TryPopN(scratch_in.data(), chunk);
+            transform(scratch_in.data(), scratch_out.data(), chunk);
+            output.TryPushN(scratch_out.data(), chunk);
+            output.Consume(output.GetPoppable());
+        }
+    }, [&](){ input.Reset(); output.Reset(); });
+    printf("  Pop, transform, push best run:\n");
+    clean_results(&results[0], (double)total);
+
+    CPipelineStage stage(input, output, [&](std::span<const std::byte> in, std::span<std::byte> out) {
+        size_t n = in.size() < out.size() ? in.size() : out.size();
+        transform(in.data(), out.data(), n);
+        return CTransformResult{n, n};
+    });
+    results[1] = bench(iter, [&]() {
+        for (size_t s = 0; s < steps; ++s)
+        {
+            input.Commit(chunk);
+            stage.Step();
+            output.Consume(output.GetPoppable());
+        }
+    }, [&](){ input.Reset(); output.Reset(); });
+    printf("  CPipelineStage best run:\n");
+    clean_results(&results[1], (double)total);
+}
+
+// Ring to ring transforms, by chunk size: scratch buffers against in place
+void pipeline_benchmark() {
+    size_t i;
+    const size_t loops = 5;
+    size_t chunks[loops] = {256, 4096, 65536, 262144, 1 << 20};
+    bench_results bench_results_metrics[loops][2];
+    for (i = 0; i < loops; ++i)
+    {
+        bench_pipeline_byte(chunks[i], 5, bench_results_metrics[i]);
+    }
+
+    printf("chunk,scratch_copies,pipeline_stage,\n");
+    for (i = 0; i < loops; ++i) {
+        printf("%ld,%lf,%lf,\n", chunks[i], bench_results_metrics[i][0].metric, bench_results_metrics[i][1].metric);
+    }
+}
+
+// Regression runner
+//
+// Named cases, each timing one hot path at a given size (and thread count)
+// for a given number of runs, selected from the command line. Results go to
+// JSON (median, mean, stddev and best of the runs) and can be checked against
+// a baseline written the same way: a case regresses when its median drops by
+// more than the threshold AND a one sided Welch t-test says it is slower at 95%.
+//
+//   benchmark --list
+//   benchmark --case byte_push_pop --size 64k --size 1m --reps 30 --json now.json
+//   benchmark --json now.json --baseline base.json --threshold 5   (exit code 1 on a regression)
+//   benchmark --suite byte_buffer   (the CSV suites below, as before)
+
+struct bench_case
+{
+    const char *name;
+    const char *description;
+    bool threaded; // runs once per --threads value
+    std::function<bench_results(size_t size, int threads, size_t reps)> run;
+};
+
+struct bench_entry
+{
+    std::string name;
+    size_t size;
+    int threads;
+    size_t runs;
+    double median; // GiB/s
+    double mean;
+    double stddev;
+    double best;
+};
+
+const bench_case bench_cases[] = {
+    {"byte_push_pop", "CByteBuffer Push then Pop of 32 byte records, a buffer full", false,
+     [](size_t size, int, size_t reps) {
+        CByteBuffer cbuf(size, (uint8_t)16); // the 4GB default is too many views for vm.max_map_count
+        size_t count = cbuf.PSize / sizeof(SomeData);
+        bench_results results = bench(reps, [&]() {
+            int64_t sum = 0;
+            for (size_t i = 0; i < count; ++i) cbuf.Push(tmp_);
+            for (size_t i = 0; i < count; ++i) sum += cbuf.Pop<SomeData>().d;
+            KEEP_ALIVE(sum);
+        }, [&](){});
+        clean_results(&results, 2.0 * sizeof(SomeData) * count);
+        return results;
+    }},
+    {"byte_reserve_peek", "CByteBuffer Reserve/Commit then Peek/Consume, 64 bytes at a time", false,
+     [](size_t size, int, size_t reps) {
+        CByteBuffer cbuf(size, (uint8_t)16); // the 4GB default is too many views for vm.max_map_count
+        size_t chunks = cbuf.PSize / 64;
+        bench_results results = bench(reps, [&]() {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < chunks; ++i)
+            {
+                std::memset(cbuf.Reserve(64).data(), 1, 64);
+                cbuf.Commit(64);
+            }
+            for (size_t i = 0; i < chunks; ++i)
+            {
+                sum += std::to_integer<uint8_t>(cbuf.Peek(64)[63]);
+                cbuf.Consume(64);
+            }
+            KEEP_ALIVE(sum);
+        }, [&](){});
+        clean_results(&results, 2.0 * 64 * chunks);
+        return results;
+    }},
+    {"byte_bulk", "CByteBuffer PushN then PopN of a buffer full of uint64_t", false,
+     [](size_t size, int, size_t reps) {
+        CByteBuffer cbuf(size, (uint8_t)16); // the 4GB default is too many views for vm.max_map_count
+        size_t count = cbuf.PSize / sizeof(uint64_t);
+        std::vector<uint64_t> src(count, 1), dst(count);
+        bench_results results = bench(reps, [&]() {
+            cbuf.PushN(src.data(), count);
+            cbuf.PopN(dst.data(), count);
+            KEEP_ALIVE(dst[count - 1]);
+        }, [&](){});
+        clean_results(&results, 2.0 * sizeof(uint64_t) * count);
+        return results;
+    }},
+    {"typed_wrap_write", "CBuffer<uint32_t> writes from the middle, across the end", false,
+     [](size_t size, int, size_t reps) {
+        CBuffer<uint32_t> cbuf(size);
+        size_t count = cbuf.GetPItemCount();
+        bench_results results = bench(reps, [&]() {
+            for (size_t i = 0; i < count; ++i) cbuf[count / 2 + i] = static_cast<uint32_t>(i);
+            KEEP_ALIVE(cbuf.Data);
+        }, [&](){});
+        clean_results(&results, (double)sizeof(uint32_t) * count);
+        return results;
+    }},
+    {"spsc_stream", "CSpscByteBuffer of `size` bytes, 1M records between two threads", false,
+     [](size_t size, int, size_t reps) {
+        CSpscByteBuffer qbuf(size);
+        int consumer_cpu = std::thread::hardware_concurrency() > 1 ? 1 : 0;
+        return bench_spsc_stream_byte(&qbuf, 0, consumer_cpu, 1 << 20, reps);
+    }},
+    {"mpmc", "CMpmcBuffer of `size` bytes, 1M uint64_t, `threads` producers and consumers", true,
+     [](size_t size, int threads, size_t reps) {
+        CMpmcBuffer<uint64_t> queue(size / sizeof(uint64_t));
+        return bench_mpmc(&queue, threads, 64, 1 << 20, reps);
+    }},
+};
+
+// The CSV suites, as run by hand so far
+const std::pair<const char *, std::function<void()>> bench_suites[] = {
+    {"typed_buffer", typed_buffer_benchmark},
+    {"byte_buffer", byte_buffer_benchmark},
+    {"mpmc_scaling", mpmc_scaling_benchmark},
+    {"tlb", tlb_benchmark},
+    {"mirror_mode", mirror_mode_benchmark},
+    {"startup", startup_benchmark},
+    {"numa", numa_benchmark},
+    {"first_touch", first_touch_benchmark},
+    {"latency", latency_benchmark},
+    {"producer_consumer", []() { producer_consumer_benchmark(default_core_pairs()); }},
+    {"lossy", lossy_benchmark},
+    {"message", message_benchmark},
+    {"static_buffer", static_buffer_benchmark},
+    {"wait_strategy", wait_strategy_benchmark},
+    {"window", window_benchmark},
+    {"soak", soak_benchmark},
+    {"record_alignment", record_alignment_benchmark},
+    {"column", column_benchmark},
+    {"journal", journal_benchmark},
+    {"broadcast", broadcast_benchmark},
+    {"pipeline", pipeline_benchmark},
+};
+
+// One sided 95% critical values of Student's t, by degrees of freedom
+double t_critical_95(double df)
+{
+    const double dfs[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 15, 20, 30, 60};
+    const double ts[] = {6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+                         1.782, 1.753, 1.725, 1.697, 1.671};
+    // the next smaller tabled df: a little conservative in between
+    for (int i = sizeof(dfs) / sizeof(dfs[0]) - 1; i >= 0; --i)
+    {
+        if (df >= dfs[i]) return ts[i];
+    }
+    return ts[0];
+}
+
+// Welch's t-test, one sided: is `current` slower than `base` at 95%?
+bool significantly_slower(const bench_entry &base, const bench_entry &current)
+{
+    double diff = base.mean - current.mean;
+    if (diff <= 0) return false;
+    if (base.runs < 2 || current.runs < 2) return true; // no spread to go by: the threshold decides
+    double vb = base.stddev * base.stddev / base.runs;
+    double vc = current.stddev * current.stddev / current.runs;
+    if (vb + vc == 0) return true;
+    double df = (vb + vc) * (vb + vc) / (vb * vb / (base.runs - 1) + vc * vc / (current.runs - 1));
+    return diff / std::sqrt(vb + vc) > t_critical_95(df);
+}
+
+void write_json(FILE *out, const std::vector<bench_entry> &entries)
+{
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const bench_entry &e = entries[i];
+        // one entry per line: read_json() relies on it
+        fprintf(out, "    {\"name\": \"%s\", \"size\": %ld, \"threads\": %d, \"runs\": %ld, "
+                     "\"median_gib_s\": %.6f, \"mean_gib_s\": %.6f, \"stddev_gib_s\": %.6f, \"best_gib_s\": %.6f}%s\n",
+                e.name.c_str(), e.size, e.threads, e.runs, e.median, e.mean, e.stddev, e.best,
+                i + 1 < entries.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Value of `"key": ` in `line`, quotes stripped, empty if missing
+std::string json_field(const std::string &line, const char *key)
+{
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t at = line.find(pattern);
+    if (at == std::string::npos) return "";
+    at += pattern.size();
+    if (line[at] == '"') return line.substr(at + 1, line.find('"', at + 1) - at - 1);
+    return line.substr(at, line.find_first_of(",}", at) - at);
+}
+
+// Entries of a file written by write_json()
+std::vector<bench_entry> read_json(const char *path)
+{
+    std::vector<bench_entry> entries;
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error(std::string("cannot read baseline ") + path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (json_field(line, "name").empty()) continue;
+        bench_entry e;
+        e.name = json_field(line, "name");
+        e.size = std::stoul(json_field(line, "size"));
+        e.threads = std::stoi(json_field(line, "threads"));
+        e.runs = std::stoul(json_field(line, "runs"));
+        e.median = std::stod(json_field(line, "median_gib_s"));
+        e.mean = std::stod(json_field(line, "mean_gib_s"));
+        e.stddev = std::stod(json_field(line, "stddev_gib_s"));
+        e.best = std::stod(json_field(line, "best_gib_s"));
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+bool same_case(const bench_entry &a, const bench_entry &b)
+{
+    return a.name == b.name && a.size == b.size && a.threads == b.threads;
+}
+
+// Prints every case against its baseline, then the baseline entries this run
+// has nothing for: `skipped` (the case threw) or no longer a case at all.
+// Returns how many regressed or went missing.
+int compare_baseline(const std::vector<bench_entry> &entries, const std::vector<bench_entry> &skipped,
+                     const std::vector<bench_entry> &baseline, double threshold)
+{
+    int regressions = 0;
+    printf("\nname,size,threads,base_median,median,change_pct,verdict,\n");
+    for (const bench_entry &e : entries)
+    {
+        const bench_entry *base = nullptr;
+        for (const bench_entry &b : baseline)
+        {
+            if (same_case(b, e)) base = &b;
+        }
+        if (base == nullptr)
+        {
+            printf("%s,%ld,%d,,%lf,,no baseline,\n", e.name.c_str(), e.size, e.threads, e.median);
+            continue;
+        }
+        double change = base->median > 0 ? (e.median - base->median) / base->median * 100 : 0;
+        bool regressed = change < -threshold && significantly_slower(*base, e);
+        regressions += regressed;
+        printf("%s,%ld,%d,%lf,%lf,%+.1f,%s,\n", e.name.c_str(), e.size, e.threads, base->median, e.median, change,
+               regressed ? "REGRESSION" : change < -threshold ? "slower, not significant" : "ok");
+    }
+    for (const bench_entry &b : baseline)
+    {
+        bool ran = false, was_skipped = false, known = false;
+        for (const bench_entry &e : entries) ran = ran || same_case(b, e);
+        for (const bench_entry &e : skipped) was_skipped = was_skipped || same_case(b, e);
+        for (const bench_case &c : bench_cases) known = known || b.name == c.name;
+        if (!ran && (was_skipped || !known))
+        {
+            printf("%s,%ld,%d,%lf,,,MISSING,\n", b.name.c_str(), b.size, b.threads, b.median);
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+// "4096", "64k", "16m", "1g"
+size_t parse_size(const char *arg)
+{
+    char *end;
+    size_t size = strtoull(arg, &end, 10);
+    if (*end == 'k' || *end == 'K') size <<= 10;
+    else if (*end == 'm' || *end == 'M') size <<= 20;
+    else if (*end == 'g' || *end == 'G') size <<= 30;
+    else if (*end != '\0') throw std::invalid_argument(std::string("bad size ") + arg);
+    return size;
+}
+
+void usage()
+{
+    printf("usage: benchmark [--list] [--suite NAME]... [--case NAME]... [--size BYTES]... [--threads N]...\n"
+           "                 [--reps N] [--json FILE] [--baseline FILE] [--threshold PCT]\n"
+           "No arguments runs the byte_buffer suite. Sizes take k, m and g suffixes.\n"
+           "Defaults: every case, --size 64k --size 1m, --threads 1 --threads 4 (threaded cases), --reps 20,\n"
+           "--threshold 5. Exits with 1 if a case regressed against --baseline.\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        byte_buffer_benchmark();
+        return 0;
+    }
+
+    std::vector<std::string> suites, cases;
+    std::vector<size_t> sizes;
+    std::vector<int> threads;
+    size_t reps = 20;
+    const char *json = nullptr, *baseline = nullptr;
+    double threshold = 5;
+    try
+    {
+        for (int a = 1; a < argc; ++a)
+        {
+            std::string arg = argv[a];
+            if (arg == "--list")
+            {
+                printf("cases:\n");
+                for (const bench_case &c : bench_cases) printf("  %-20s %s\n", c.name, c.description);
+                printf("suites:\n");
+                for (const auto &suite : bench_suites) printf("  %s\n", suite.first);
+                return 0;
+            }
+            if (arg == "--help" || arg == "-h")
+            {
+                usage();
+                return 0;
+            }
+            if (a + 1 == argc) throw std::invalid_argument(arg + " needs a value");
+            const char *value = argv[++a];
+            if (arg == "--suite") suites.push_back(value);
+            else if (arg == "--case") cases.push_back(value);
+            else if (arg == "--size") sizes.push_back(parse_size(value));
+            else if (arg == "--threads") threads.push_back(std::stoi(value));
+            else if (arg == "--reps") reps = std::stoul(value);
+            else if (arg == "--json") json = value;
+            else if (arg == "--baseline") baseline = value;
+            else if (arg == "--threshold") threshold = std::stod(value);
+            else throw std::invalid_argument("unknown option " + arg);
+        }
+        for (const std::string &name : cases)
+        {
+            bool known = false;
+            for (const bench_case &c : bench_cases) known = known || name == c.name;
+            if (!known) throw std::invalid_argument("unknown case " + name);
+        }
+        if (reps == 0) throw std::invalid_argument("--reps must be at least 1");
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "benchmark: %s\n", e.what());
+        usage();
+        return 2;
+    }
+
+    for (const std::string &name : suites)
+    {
+        bool found = false;
+        for (const auto &suite : bench_suites)
+        {
+            if (name == suite.first)
+            {
+                suite.second();
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "benchmark: unknown suite %s\n", name.c_str());
+            return 2;
+        }
+    }
+    if (!suites.empty() && cases.empty() && json == nullptr && baseline == nullptr)
+    {
+        return 0;
+    }
+
+    if (sizes.empty()) sizes = {64 << 10, 1 << 20};
+    if (threads.empty()) threads = {1, 4};
+    std::vector<bench_entry> entries, skipped;
+    for (const bench_case &c : bench_cases)
+    {
+        if (!cases.empty() && std::find(cases.begin(), cases.end(), c.name) == cases.end()) continue;
+        for (size_t size : sizes)
+        {
+            for (size_t t = 0; t < (c.threaded ? threads.size() : 1); ++t)
+            {
+                int n = c.threaded ? threads[t] : 1;
+                printf("\n%s, size %ld, threads %d\n", c.name, size, n);
+                bench_results results;
+                try
+                {
+                    results = c.run(size, n, reps);
+                }
+                catch (const std::exception &e)
+                {
+                    // vm.max_map_count too low for the views, no memory...: no entry, the baseline says so
+                    fprintf(stderr, "benchmark: %s, size %ld skipped: %s\n", c.name, size, e.what());
+                    skipped.push_back(bench_entry{c.name, size, n, 0, 0, 0, 0, 0});
+                    continue;
+                }
+                entries.push_back(bench_entry{c.name, size, n, results.runs.size(), results.median_metric,
+                                              results.mean_metric, results.stddev_metric, results.metric});
+            }
+        }
+    }
+
+    if (json != nullptr)
+    {
+        FILE *out = fopen(json, "w");
+        if (out == nullptr)
+        {
+            fprintf(stderr, "benchmark: cannot write %s\n", json);
+            return 2;
+        }
+        write_json(out, entries);
+        fclose(out);
+    }
+    else
+    {
+        write_json(stdout, entries);
+    }
+
+    if (baseline != nullptr)
+    {
+        std::vector<bench_entry> base;
+        try
+        {
+            base = read_json(baseline);
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stderr, "benchmark: %s\n", e.what());
+            return 2;
+        }
+        int regressions = compare_baseline(entries, skipped, base, threshold);
+        if (regressions)
+        {
+            printf("%d regression%s (or missing case%s) against %s\n", regressions, regressions > 1 ? "s" : "",
+                   regressions > 1 ? "s" : "", baseline);
+            return 1;
+        }
+    }
     return 0;
 }
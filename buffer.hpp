@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <cstdint>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
@@ -22,6 +23,8 @@
 #include <type_traits>
 #include <stdexcept>
 
+#include "bulkcopy.hpp"
+
 // Classic Circular Buffer
 template <typename T>
 class Buffer
@@ -73,6 +76,24 @@ public:
             return Data[index & Count-1];
         }
     };
+
+    // Copies `n` items from `src` to `index` onwards, wrapping to the start
+    void WriteN(size_t index, const T* src, size_t n)
+    {
+        if (index >= Count) index &= Count-1;
+        size_t firstPart = n < Count - index ? n : Count - index;
+        BulkCopy(&Data[index], src, firstPart * sizeof(T));
+        BulkCopy(&Data[0], src + firstPart, (n - firstPart) * sizeof(T));
+    };
+
+    // Copies `n` items from `index` onwards to `dst`, wrapping to the start
+    void ReadN(size_t index, T* dst, size_t n) const
+    {
+        if (index >= Count) index &= Count-1;
+        size_t firstPart = n < Count - index ? n : Count - index;
+        BulkCopy(dst, &Data[index], firstPart * sizeof(T));
+        BulkCopy(dst + firstPart, &Data[0], (n - firstPart) * sizeof(T));
+    };
 };
 
 class ByteBuffer
@@ -159,6 +180,246 @@ public:
             return data;
         }
     };
+
+    // Puts `n` items at head, with one index update.
+    template <typename T>
+    void PushN(const T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>, "Type must be safe to copy via memory");
+
+        const std::byte* src = reinterpret_cast<const std::byte*>(data);
+        size_t bytes = n * sizeof(T);
+        size_t firstPart = bytes < Capacity - Head ? bytes : Capacity - Head;
+        BulkCopy(&Data[Head], src, firstPart);
+        BulkCopy(&Data[0], src + firstPart, bytes - firstPart);
+        Head += bytes;
+        if (Head >= Capacity) Head -= Capacity;
+    };
+
+    // Gets `n` items at tail, with one index update.
+    template <typename T>
+    void PopN(T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>, "Type must be safe to copy via memory");
+
+        std::byte* dst = reinterpret_cast<std::byte*>(data);
+        size_t bytes = n * sizeof(T);
+        size_t firstPart = bytes < Capacity - Tail ? bytes : Capacity - Tail;
+        BulkCopy(dst, &Data[Tail], firstPart);
+        BulkCopy(dst + firstPart, &Data[0], bytes - firstPart);
+        Tail += bytes;
+        if (Tail >= Capacity) Tail -= Capacity;
+    };
+
+    // Reads up to `max` bytes from `fd` straight into the buffer, at head:
+    // one readv() over the two parts, before and after the end of the buffer.
+    // Returns the bytes read (Head moves by as much), 0 on end of file, -1 on error (errno).
+    ssize_t ReadFrom(int fd, size_t max)
+    {
+        struct iovec iov[2];
+        int count = Split(Head, max, iov);
+        ssize_t n = readv(fd, iov, count);
+        if (n > 0)
+        {
+            Head += n;
+            if (Head >= Capacity) Head -= Capacity;
+        }
+        return n;
+    };
+
+    // Writes up to `max` bytes to `fd` straight from the buffer, at tail:
+    // one writev() over the two parts.
+    // Returns the bytes written (Tail moves by as much), -1 on error (errno).
+    ssize_t WriteTo(int fd, size_t max)
+    {
+        struct iovec iov[2];
+        int count = Split(Tail, max, iov);
+        ssize_t n = writev(fd, iov, count);
+        if (n > 0)
+        {
+            Tail += n;
+            if (Tail >= Capacity) Tail -= Capacity;
+        }
+        return n;
+    };
+
+private:
+    // `n` bytes from `index`, wrapping to the start: one or two iovecs
+    int Split(size_t index, size_t n, struct iovec *iov)
+    {
+        size_t firstPart = n < Capacity - index ? n : Capacity - index;
+        iov[0] = {&Data[index], firstPart};
+        iov[1] = {&Data[0], n - firstPart};
+        return n > firstPart ? 2 : 1;
+    };
+};
+
+// Circular Buffer with a compile time, power of two, capacity of `N` items:
+// indexing is a single AND, and loop bounds are constants.
+template <typename T, size_t N>
+class StaticBuffer
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "StaticBuffer requires a trivially copyable type.");
+    static_assert(N > 0 && (N & (N - 1)) == 0,
+                  "StaticBuffer capacity must be a power of two.");
+
+public:
+    static constexpr size_t Count = N; // Max elements in the Buffer
+    T *Data;                           // Buffer
+
+    StaticBuffer() : Data(static_cast<T *>(std::malloc(Count * sizeof(T)))) {}
+
+    ~StaticBuffer()
+    {
+        std::free(Data);
+    };
+
+    StaticBuffer(const StaticBuffer &) = delete;
+    StaticBuffer &operator=(const StaticBuffer &) = delete;
+
+    // Size of the buffer in bytes
+    static constexpr size_t GetSize()
+    {
+        return Count * sizeof(T);
+    }
+
+    T &operator[](size_t index)
+    {
+        return Data[index & (Count - 1)];
+    };
+
+    const T &operator[](size_t index) const
+    {
+        return Data[index & (Count - 1)];
+    };
+
+    // Copies `n` items from `src` to `index` onwards, wrapping to the start
+    void WriteN(size_t index, const T* src, size_t n)
+    {
+        index &= Count - 1;
+        size_t firstPart = n < Count - index ? n : Count - index;
+        BulkCopy(&Data[index], src, firstPart * sizeof(T));
+        BulkCopy(&Data[0], src + firstPart, (n - firstPart) * sizeof(T));
+    };
+
+    // Copies `n` items from `index` onwards to `dst`, wrapping to the start
+    void ReadN(size_t index, T* dst, size_t n) const
+    {
+        index &= Count - 1;
+        size_t firstPart = n < Count - index ? n : Count - index;
+        BulkCopy(dst, &Data[index], firstPart * sizeof(T));
+        BulkCopy(dst + firstPart, &Data[0], (n - firstPart) * sizeof(T));
+    };
+};
+
+// Byte Circular Buffer with a compile time, power of two, capacity of `N` bytes:
+// Head and Tail wrap with a mask.
+template <size_t N>
+class StaticByteBuffer
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0,
+                  "StaticByteBuffer capacity must be a power of two.");
+
+public:
+    static constexpr size_t Capacity = N; // Max capacity of Buffer
+    std::byte *Data;                      // Buffer
+    size_t Head;                          // Buffer Head: next push
+    size_t Tail;                          // Buffer Tail: next pop
+
+    StaticByteBuffer() : Data(static_cast<std::byte *>(std::malloc(Capacity))),
+                         Head(0),
+                         Tail(0) {}
+
+    ~StaticByteBuffer()
+    {
+        std::free(Data);
+    };
+
+    void Reset()
+    {
+        Head=0;
+        Tail=0;
+    };
+
+    StaticByteBuffer(const StaticByteBuffer &) = delete;
+    StaticByteBuffer &operator=(const StaticByteBuffer &) = delete;
+
+    std::byte &operator[](size_t index)
+    {
+        return Data[index & (Capacity - 1)];
+    };
+
+    const std::byte &operator[](size_t index) const
+    {
+        return Data[index & (Capacity - 1)];
+    };
+
+    template <typename T>
+    void Push(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>, "Type must be safe to copy via memory");
+
+        // a single byte never straddles the end: no cold path to build
+        if constexpr (sizeof(T) > 1) {
+            if (__builtin_expect(Head + sizeof(T) > Capacity, 0)) {
+                // cold path
+                const std::byte* src = reinterpret_cast<const std::byte*>(&data);
+                size_t firstPart = Capacity - Head;
+                std::memcpy(&Data[Head], src, firstPart);
+                std::memcpy(&Data[0], src + firstPart, sizeof(T) - firstPart);
+                Head = sizeof(T) - firstPart;
+                return;
+            }
+        }
+        // hot path
+        *reinterpret_cast<T*>(&Data[Head]) = data;
+        Head = (Head + sizeof(T)) & (Capacity - 1);
+    };
+
+    template <typename T>
+    T Pop() {
+        static_assert(std::is_trivially_copyable_v<T>, "Type must be safe to copy via memory");
+
+        if constexpr (sizeof(T) > 1) {
+            if (__builtin_expect(Tail + sizeof(T) > Capacity, 0)) {
+                // cold path
+                T data;
+                size_t firstPart = Capacity - Tail;
+                std::memcpy(&data, &Data[Tail], firstPart);
+                std::memcpy(reinterpret_cast<std::byte*>(&data) + firstPart, &Data[0], sizeof(T) - firstPart);
+                Tail = sizeof(T) - firstPart;
+                return data;
+            }
+        }
+        // hot path
+        T data = *reinterpret_cast<const T*>(&Data[Tail]);
+        Tail = (Tail + sizeof(T)) & (Capacity - 1);
+        return data;
+    };
+
+    // Puts `n` items at head, with one index update.
+    template <typename T>
+    void PushN(const T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>, "Type must be safe to copy via memory");
+
+        const std::byte* src = reinterpret_cast<const std::byte*>(data);
+        size_t bytes = n * sizeof(T);
+        size_t firstPart = bytes < Capacity - Head ? bytes : Capacity - Head;
+        BulkCopy(&Data[Head], src, firstPart);
+        BulkCopy(&Data[0], src + firstPart, bytes - firstPart);
+        Head = (Head + bytes) & (Capacity - 1);
+    };
+
+    // Gets `n` items at tail, with one index update.
+    template <typename T>
+    void PopN(T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>, "Type must be safe to copy via memory");
+
+        std::byte* dst = reinterpret_cast<std::byte*>(data);
+        size_t bytes = n * sizeof(T);
+        size_t firstPart = bytes < Capacity - Tail ? bytes : Capacity - Tail;
+        BulkCopy(dst, &Data[Tail], firstPart);
+        BulkCopy(dst + firstPart, &Data[0], bytes - firstPart);
+        Tail = (Tail + bytes) & (Capacity - 1);
+    };
 };
 
 #endif
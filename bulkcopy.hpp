@@ -0,0 +1,136 @@
+#ifndef BULK_COPY_HPP
+#define BULK_COPY_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <x86intrin.h>
+
+// Bulk copy kernels for PushN/PopN.
+//
+// Small copies go straight to memcpy. Bigger ones use the widest vector
+// unit the CPU has (AVX-512, AVX2), picked once at startup. Copies bigger
+// than half the last level cache use non-temporal (streaming) stores: the
+// destination would be evicted before anyone reads it anyway, so we skip
+// the read-for-ownership and leave the cache to the consumer.
+
+constexpr size_t BULK_COPY_MIN = 256; // Below this, memcpy
+
+// Above this, non-temporal stores: half the last level cache (or 1MB if unknown)
+inline size_t GetStreamingThreshold()
+{
+    static const size_t threshold = []() {
+        long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        return llc > 0 ? static_cast<size_t>(llc) / 2 : static_cast<size_t>(1 << 20);
+    }();
+    return threshold;
+}
+
+__attribute__((target("avx2")))
+inline void BulkCopyAvx2(std::byte *dst, const std::byte *src, size_t n, bool streaming)
+{
+    if (streaming)
+    {
+        // streaming stores need an aligned destination
+        size_t head = (32 - (reinterpret_cast<uintptr_t>(dst) & 31)) & 31;
+        std::memcpy(dst, src, head);
+        dst += head; src += head; n -= head;
+        for (; n >= 128; n -= 128, dst += 128, src += 128)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 64));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 96));
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), a);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 32), b);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 64), c);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 96), d);
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; n >= 128; n -= 128, dst += 128, src += 128)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 64));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 96));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), a);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32), b);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 64), c);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 96), d);
+        }
+    }
+    std::memcpy(dst, src, n);
+}
+
+__attribute__((target("avx512f")))
+inline void BulkCopyAvx512(std::byte *dst, const std::byte *src, size_t n, bool streaming)
+{
+    if (streaming)
+    {
+        size_t head = (64 - (reinterpret_cast<uintptr_t>(dst) & 63)) & 63;
+        std::memcpy(dst, src, head);
+        dst += head; src += head; n -= head;
+        for (; n >= 256; n -= 256, dst += 256, src += 256)
+        {
+            __m512i a = _mm512_loadu_si512(src);
+            __m512i b = _mm512_loadu_si512(src + 64);
+            __m512i c = _mm512_loadu_si512(src + 128);
+            __m512i d = _mm512_loadu_si512(src + 192);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst), a);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 64), b);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 128), c);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 192), d);
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; n >= 256; n -= 256, dst += 256, src += 256)
+        {
+            __m512i a = _mm512_loadu_si512(src);
+            __m512i b = _mm512_loadu_si512(src + 64);
+            __m512i c = _mm512_loadu_si512(src + 128);
+            __m512i d = _mm512_loadu_si512(src + 192);
+            _mm512_storeu_si512(dst, a);
+            _mm512_storeu_si512(dst + 64, b);
+            _mm512_storeu_si512(dst + 128, c);
+            _mm512_storeu_si512(dst + 192, d);
+        }
+    }
+    std::memcpy(dst, src, n);
+}
+
+inline void BulkCopyScalar(std::byte *dst, const std::byte *src, size_t n, bool)
+{
+    std::memcpy(dst, src, n);
+}
+
+// CPU dispatch, resolved on first use
+inline auto GetBulkCopyKernel()
+{
+    using Kernel = void (*)(std::byte *, const std::byte *, size_t, bool);
+    static const Kernel kernel = []() -> Kernel {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return BulkCopyAvx512;
+        if (__builtin_cpu_supports("avx2")) return BulkCopyAvx2;
+        return BulkCopyScalar;
+    }();
+    return kernel;
+}
+
+// Copies `n` bytes, `dst` and `src` must not overlap
+inline void BulkCopy(void *dst, const void *src, size_t n)
+{
+    if (n < BULK_COPY_MIN)
+    {
+        std::memcpy(dst, src, n);
+        return;
+    }
+    GetBulkCopyKernel()(static_cast<std::byte *>(dst), static_cast<const std::byte *>(src),
+                        n, n >= GetStreamingThreshold());
+}
+
+#endif
@@ -6,6 +6,9 @@
 #include <stdint.h>
 #include <cstdint>
 #include <sys/mman.h>
+#include <linux/memfd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
@@ -15,19 +18,417 @@
 #include <functional>
 #include <x86intrin.h>
 #include <sys/time.h>
+#include <span>
+#include <memory>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <atomic>
 
+#include "bulkcopy.hpp"
 
-inline size_t ToNextPageSize(size_t v)
+
+inline size_t ToNextPageSize(size_t v, size_t page_size)
 {
-    const size_t PAGE_SIZE = sysconf(_SC_PAGESIZE);
-    if (v < PAGE_SIZE)
+    if (v < page_size)
     {
-        return PAGE_SIZE;
+        return page_size;
     }
     else
     {
-        return ((v + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+        return ((v + page_size - 1) / page_size) * page_size;
+    }
+}
+
+inline size_t ToNextPageSize(size_t v)
+{
+    return ToNextPageSize(v, sysconf(_SC_PAGESIZE));
+}
+
+// Producer and consumer state live on separate cache lines, so one side
+// writing its index does not invalidate the line the other side is reading.
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+constexpr size_t HUGE_PAGE_2MB = 2ul << 20;
+constexpr size_t HUGE_PAGE_1GB = 1ul << 30;
+
+// How many views of the physical buffer make up the virtual buffer.
+enum class MirrorMode
+{
+    Virtual, // Many views: VSize is 16x PSize for CBuffer, ~4GB for CByteBuffer (default)
+    Double,  // Exactly two views (2 VMAs), the classic magic ring buffer.
+             // CByteBuffer keeps Head and Tail modulo PSize.
+};
+
+// How the physical buffer is backed and mapped.
+struct CBufferOptions
+{
+    MirrorMode Mode = MirrorMode::Virtual;
+
+    // 0 for regular pages, or HUGE_PAGE_2MB / HUGE_PAGE_1GB to back the buffer
+    // with huge pages (hugetlbfs). PSize and VSize are rounded up to it.
+    // Falls back to regular pages when no huge pages are available.
+    size_t HugePageSize = 0;
+
+    // NUMA node to bind the physical buffer to (mbind, strict), or -1 to leave
+    // it to the first-touch policy.
+    int NumaNode = -1;
+
+    // Fault in the physical buffer at construction (MADV_POPULATE_WRITE),
+    // on `NumaNode` if set, instead of on first touch.
+    bool Populate = false;
+
+    // Also fault in the page tables of every view, so the first lap through
+    // the virtual buffer takes no page faults at all.
+    bool Prefault = false;
+
+    // mlock the whole virtual buffer: never swapped out, never faulted again.
+    // Needs RLIMIT_MEMLOCK (or CAP_IPC_LOCK) for the physical buffer.
+    bool Lock = false;
+
+    // Keep the memfd open for the life of the buffer, so CByteBuffer can
+    // Grow() and Shrink(). Costs a file descriptor per buffer.
+    bool Resizable = false;
+};
+
+// Hot path counters of the byte buffers, opt-in at compile time: build with
+// -DCBUFFER_STATS=1 (cmake -DCBUFFER_STATS=ON). Without it the buffers hold a
+// CNoBufferStats, an empty member whose calls compile to nothing.
+#ifndef CBUFFER_STATS
+#define CBUFFER_STATS 0
+#endif
+
+// Counters of a buffer at one point, since its last Reset(), for export
+struct CBufferStatsSnapshot
+{
+    bool Enabled = false;     // Built with CBUFFER_STATS, all zeros otherwise
+    uint64_t BytesPushed = 0;
+    uint64_t BytesPopped = 0;
+    uint64_t HighWater = 0;   // Most bytes held at once (as the producer sees it)
+    uint64_t FullStalls = 0;  // Pushes that found no room: refused, or overwriting unread bytes (CByteBuffer)
+    uint64_t EmptyStalls = 0; // Pops that found too few bytes: refused, or reading past Head (CByteBuffer)
+    uint64_t Wraps = 0;       // Head or Tail going round the end of the buffer
+};
+
+// Counter written by one thread, read by any: a relaxed load and store, no
+// locked instruction on the hot path.
+class CStatCounter
+{
+public:
+    void Add(uint64_t n)
+    {
+        Value.store(Value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    };
+
+    void Max(uint64_t v)
+    {
+        if (v > Value.load(std::memory_order_relaxed)) Value.store(v, std::memory_order_relaxed);
+    };
+
+    uint64_t Get() const
+    {
+        return Value.load(std::memory_order_relaxed);
+    };
+
+    void Reset()
+    {
+        Value.store(0, std::memory_order_relaxed);
+    };
+
+private:
+    std::atomic<uint64_t> Value{0};
+};
+
+// Counters of one buffer. The producer and the consumer each write their own
+// cache line, so a queue keeps its two sides apart with stats on.
+class CBufferStats
+{
+public:
+    // Producer: `n` bytes pushed, `held` in the buffer after them
+    void Pushed(uint64_t n, uint64_t held, bool wrapped)
+    {
+        BytesPushed.Add(n);
+        HighWater.Max(held);
+        if (wrapped) HeadWraps.Add(1);
+    };
+
+    // Consumer: `n` bytes popped
+    void Popped(uint64_t n, bool wrapped)
+    {
+        BytesPopped.Add(n);
+        if (wrapped) TailWraps.Add(1);
+    };
+
+    void FullStall()
+    {
+        FullStalls.Add(1);
+    };
+
+    void EmptyStall()
+    {
+        EmptyStalls.Add(1);
+    };
+
+    // Bytes pushed and not popped yet. Exact only when one thread does both.
+    uint64_t GetHeld() const
+    {
+        uint64_t pushed = BytesPushed.Get(), popped = BytesPopped.Get();
+        return pushed > popped ? pushed - popped : 0;
+    };
+
+    // Any thread, while the buffer runs: each counter is read on its own
+    CBufferStatsSnapshot Snapshot() const
+    {
+        CBufferStatsSnapshot s;
+        s.Enabled = true;
+        s.BytesPushed = BytesPushed.Get();
+        s.BytesPopped = BytesPopped.Get();
+        s.HighWater = HighWater.Get();
+        s.FullStalls = FullStalls.Get();
+        s.EmptyStalls = EmptyStalls.Get();
+        s.Wraps = HeadWraps.Get() + TailWraps.Get();
+        return s;
+    };
+
+    void Reset()
+    {
+        BytesPushed.Reset();
+        HighWater.Reset();
+        FullStalls.Reset();
+        HeadWraps.Reset();
+        BytesPopped.Reset();
+        EmptyStalls.Reset();
+        TailWraps.Reset();
+    };
+
+private:
+    // Producer side
+    alignas(CACHE_LINE_SIZE) CStatCounter BytesPushed;
+    CStatCounter HighWater;
+    CStatCounter FullStalls;
+    CStatCounter HeadWraps;
+
+    // Consumer side
+    alignas(CACHE_LINE_SIZE) CStatCounter BytesPopped;
+    CStatCounter EmptyStalls;
+    CStatCounter TailWraps;
+};
+
+// CBufferStats compiled out: same calls, nothing counted
+struct CNoBufferStats
+{
+    void Pushed(uint64_t, uint64_t, bool) {};
+    void Popped(uint64_t, bool) {};
+    void FullStall() {};
+    void EmptyStall() {};
+    uint64_t GetHeld() const { return 0; };
+    CBufferStatsSnapshot Snapshot() const { return CBufferStatsSnapshot(); };
+    void Reset() {};
+};
+
+using CBufferStatsType = std::conditional_t<CBUFFER_STATS, CBufferStats, CNoBufferStats>;
+
+// Reserves VSize bytes of address space (PROT_NONE) for the views of a mirror,
+// aligned to `align` if not 0. Returns the base address.
+inline void *ReserveMirror(size_t VSize, size_t align = 0)
+{
+    void *Base = mmap(NULL, VSize + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Base == MAP_FAILED)
+    {
+        throw std::runtime_error("Virtual reservation failed");
+    }
+    if (align)
+    {
+        // keep only the aligned VSize bytes of the reservation
+        char *aligned = (char *)(((uintptr_t)Base + align - 1) & ~(uintptr_t)(align - 1));
+        size_t before = aligned - (char *)Base;
+        if (before) munmap(Base, before);
+        munmap(aligned + VSize, align - before);
+        Base = aligned;
+    }
+    return Base;
+}
+
+// Reserves VSize bytes of virtual memory and maps the same PSize bytes of
+// `fd`, starting at `offset`, over it, back to back. Returns the base address.
+// VSize must be a multiple of PSize. `fd` stays open, it is up to the caller.
+//
+// With a `huge_page_size`, the mirror starts on a huge page boundary.
+// `fd` must be on hugetlbfs, and PSize a multiple of it.
+// `flags` are the sharing flags of every view: MAP_SHARED, or
+// MAP_SHARED_VALIDATE | MAP_SYNC for a DAX file.
+inline void *MapMirrorFd(int fd, off_t offset, size_t PSize, size_t VSize, size_t huge_page_size = 0,
+                         int flags = MAP_SHARED)
+{
+    void *Base = ReserveMirror(VSize, huge_page_size);
+    for (size_t i = 0; i < VSize / PSize; ++i)
+    {
+        void *addr = (char *)Base + (i * PSize);
+        if (mmap(addr, PSize, PROT_READ | PROT_WRITE, flags | MAP_FIXED, fd, offset) == MAP_FAILED)
+        {
+            munmap(Base, VSize); // try to unmap, otherwise will not exit probram
+            throw std::runtime_error("Physical mapping failed");
+        }
+    }
+    return Base;
+}
+
+// Maps a mirror (MapMirrorFd) of a new PSize bytes memfd, closed once mapped,
+// or kept open in `*keep_fd` if set.
+//
+// With a `huge_page_size`, the memfd is created on hugetlbfs.
+inline void *MapMirror(size_t PSize, size_t VSize, const char *name, size_t huge_page_size = 0, int *keep_fd = nullptr)
+{
+    unsigned int flags = 0;
+    if (huge_page_size)
+    {
+        flags = MFD_HUGETLB | (__builtin_ctzll(huge_page_size) << MFD_HUGE_SHIFT);
+    }
+    int fd = memfd_create(name, flags);
+    if (fd == -1)
+    {
+        throw std::runtime_error("memfd_create failed");
+    }
+    if (ftruncate(fd, PSize) == -1)
+    {
+        close(fd);
+        throw std::runtime_error("ftruncate failed");
+    }
+
+    try
+    {
+        void *Base = MapMirrorFd(fd, 0, PSize, VSize, huge_page_size);
+        if (keep_fd != nullptr) *keep_fd = fd;
+        else close(fd);
+        return Base;
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+}
+
+// Maps the mirror on huge pages, following `options`. PSize and VSize
+// are rounded up to the huge page size (keeping at least two views)
+// and PageSize is set to it. Returns nullptr, leaving the sizes untouched,
+// when huge pages were not asked for or are not available.
+inline void *MapHugeMirror(size_t &PSize, size_t &VSize, size_t &PageSize,
+                           const char *name, const CBufferOptions &options, int *keep_fd = nullptr)
+{
+    if (options.HugePageSize == 0)
+    {
+        return nullptr;
+    }
+
+    size_t psize = ToNextPageSize(PSize, options.HugePageSize);
+    size_t vsize = ToNextPageSize(VSize, psize);
+    if (vsize < 2*psize) vsize = 2*psize;
+    try
+    {
+        void *Base = MapMirror(psize, vsize, name, options.HugePageSize, keep_fd);
+        PSize = psize;
+        VSize = vsize;
+        PageSize = options.HugePageSize;
+        return Base;
+    }
+    catch (const std::runtime_error &)
+    {
+        // no hugetlbfs, or no huge pages reserved (vm.nr_hugepages)
+        return nullptr;
+    }
+}
+
+// Binds the physical buffer (mapped at `Base`) to `options.NumaNode`, and
+// faults it in if `options.Populate`. The memory policy of a memfd is shared
+// by all its views, so the first view is enough.
+// Then, prefaults (`options.Prefault`) and locks (`options.Lock`) every view.
+inline void PlaceMirror(void *Base, size_t PSize, size_t VSize, size_t PageSize, const CBufferOptions &options)
+{
+    if (options.NumaNode >= 0)
+    {
+        unsigned long nodemask[16] = {}; // up to 1024 nodes
+        if (options.NumaNode >= (int)(sizeof(nodemask) * 8))
+        {
+            throw std::invalid_argument("NUMA node out of range");
+        }
+        nodemask[options.NumaNode / 64] |= 1ul << (options.NumaNode % 64);
+        if (syscall(SYS_mbind, Base, PSize, MPOL_BIND, nodemask, sizeof(nodemask) * 8,
+                    MPOL_MF_STRICT | MPOL_MF_MOVE) == -1 && errno != ENOSYS) // ENOSYS: no NUMA, one node
+        {
+            throw std::runtime_error("mbind failed");
+        }
+    }
+
+    if (options.Populate)
+    {
+        if (madvise(Base, PSize, MADV_POPULATE_WRITE) == -1)
+        {
+            if (errno != EINVAL)
+            {
+                throw std::runtime_error("Populating the buffer failed");
+            }
+            // kernels before 5.14: touch every page, the buffer is still all zeros
+            for (size_t i = 0; i < PSize; i += PageSize)
+            {
+                static_cast<volatile char *>(Base)[i] = 0;
+            }
+        }
+    }
+
+    if (options.Prefault)
+    {
+        // views are separate mappings, each one faults on its own
+        if (madvise(Base, VSize, MADV_POPULATE_WRITE) == -1)
+        {
+            if (errno != EINVAL)
+            {
+                throw std::runtime_error("Prefaulting the buffer failed");
+            }
+            for (size_t i = 0; i < VSize; i += PageSize)
+            {
+                static_cast<volatile char *>(Base)[i] = 0;
+            }
+        }
+    }
+
+    if (options.Lock)
+    {
+        if (mlock(Base, VSize) == -1)
+        {
+            throw std::runtime_error("mlock failed");
+        }
+    }
+}
+
+// Maps the mirror following `options`: on huge pages if asked and available
+// (MapHugeMirror, may round PSize and VSize up), on regular pages otherwise,
+// then places it (PlaceMirror). Sets PageSize and returns the base address.
+// The memfd is kept open in `*keep_fd` if set.
+inline void *AllocateMirror(size_t &PSize, size_t &VSize, size_t &PageSize,
+                            const char *name, const CBufferOptions &options, int *keep_fd = nullptr)
+{
+    PageSize = sysconf(_SC_PAGESIZE);
+    void *Base = MapHugeMirror(PSize, VSize, PageSize, name, options, keep_fd);
+    if (Base == nullptr)
+    {
+        Base = MapMirror(PSize, VSize, name, 0, keep_fd);
+    }
+
+    try
+    {
+        PlaceMirror(Base, PSize, VSize, PageSize, options);
+    }
+    catch (...)
+    {
+        munmap(Base, VSize);
+        if (keep_fd != nullptr)
+        {
+            close(*keep_fd);
+            *keep_fd = -1;
+        }
+        throw;
     }
+    return Base;
 }
 
 // Circular Buffer of (probably) 4kb, but feels way bigger.
@@ -43,33 +444,36 @@ class CBuffer
                   "CBuffer requires a trivially copyable type.");
 
 public:
-    size_t PSize; // Physical buffer size (multiple of your page size, probably 4096)
-    size_t VSize; // Virtual buffer size, how much the buffer actually feels like (>= PSize)
-    T *Data;      // Buffer
+    size_t PSize;    // Physical buffer size (multiple of your page size, probably 4096)
+    size_t VSize;    // Virtual buffer size, how much the buffer actually feels like (>= PSize)
+    size_t PageSize; // Page size backing the buffer (regular or huge)
+    T *Data;         // Buffer
 
     // Physical size is one page, usually 4096 (default)
     // Virtual size is 16x size of the physical buffer (default)
     CBuffer() : PSize(sysconf(_SC_PAGESIZE)),
                 VSize(16*PSize)
     {
-        Allocate();
+        Allocate(CBufferOptions());
     };
 
     // Custom Physical size (must be multiple of page size)
     // Virtual size is 16x size of the physical buffer (default)
-    CBuffer(size_t pbuffer_size_) : PSize(ToNextPageSize(pbuffer_size_)),
-                                    VSize(16*PSize)
+    CBuffer(size_t pbuffer_size_,
+            const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                 VSize(16*PSize)
     {
-        Allocate();
+        Allocate(options_);
     };
 
     // Custom Physical size (must be multiple of page size)
     // Custom Virtual size multiplier: is x times sizes of the physical buffer
     CBuffer(size_t pbuffer_size_,
-            uint8_t vbuffer_mult_) : PSize(ToNextPageSize(pbuffer_size_)),
-                                     VSize(vbuffer_mult_*PSize)
+            uint8_t vbuffer_mult_,
+            const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                 VSize(vbuffer_mult_*PSize)
     {
-        Allocate();
+        Allocate(options_);
     };
 
     ~CBuffer()
@@ -116,38 +520,108 @@ public:
         return Data[index];
     };
 
+    // Copies `n` items from `src` to `index` onwards.
+    // No wraparound needed: `index + n` only has to fit in the virtual buffer.
+    void WriteN(size_t index, const T* src, size_t n)
+    {
+        BulkCopy(&Data[index], src, n * sizeof(T));
+    };
+
+    // Copies `n` items from `index` onwards to `dst`
+    void ReadN(size_t index, T* dst, size_t n) const
+    {
+        BulkCopy(dst, &Data[index], n * sizeof(T));
+    };
+
 private:
-    void Allocate()
+    void Allocate(const CBufferOptions &options)
     {
-        if (VSize < PSize)
+        if (VSize < PSize || options.Mode == MirrorMode::Double)
         {
-            VSize = PSize;
+            VSize = options.Mode == MirrorMode::Double ? 2*PSize : PSize;
         }
 
-        void *Base = mmap(NULL, VSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (Base == MAP_FAILED)
+        Data = static_cast<T *>(AllocateMirror(PSize, VSize, PageSize, "cbuffer", options));
+    };
+};
+
+// Framed messages: a uint32_t payload size, padded to `Align`, then the
+// payload, padded to `Align`. Headers and payloads both start on `Align`
+// boundaries, for aligned loads.
+template <size_t Align>
+struct CMessageFrame
+{
+    static_assert(Align >= sizeof(uint32_t) && (Align & (Align - 1)) == 0,
+                  "Message alignment must be a power of two, at least 4.");
+
+    static constexpr size_t HEADER = Align; // Header slot: the size, padded
+
+    // Framed bytes of a `size` bytes message
+    static constexpr size_t GetFramedSize(size_t size)
+    {
+        return HEADER + ((size + Align - 1) & ~(Align - 1));
+    };
+
+    static uint32_t GetSize(const std::byte *header)
+    {
+        uint32_t size;
+        std::memcpy(&size, header, sizeof(uint32_t));
+        return size;
+    };
+};
+
+// `Count` framed messages in place, oldest first, for draining many messages
+// at once: a range of payload spans. GetBytes() is how much to Consume() after.
+template <size_t Align>
+class CMessageBatch
+{
+public:
+    class Iterator
+    {
+    public:
+        const std::byte *Pos; // Header of the current message
+        size_t Left;          // Messages left, this one included
+
+        std::span<const std::byte> operator*() const
         {
-            throw std::runtime_error("Virtual reservation failed");
-        }
-        Data = static_cast<T *>(Base);
+            return std::span<const std::byte>(Pos + CMessageFrame<Align>::HEADER, CMessageFrame<Align>::GetSize(Pos));
+        };
 
-        int fd = memfd_create("cbuffer", 0);
-        if (fd == -1)
+        Iterator &operator++()
         {
-            throw std::runtime_error("memfd_create failed");
-        }
-        ftruncate(fd, PSize);
+            Pos += CMessageFrame<Align>::GetFramedSize(CMessageFrame<Align>::GetSize(Pos));
+            --Left;
+            return *this;
+        };
 
-        for (size_t i = 0; i < GetPageCount(); ++i)
+        bool operator!=(const Iterator &other) const
         {
-            void *addr = (char *)Base + (i * PSize);
-            if (mmap(addr, PSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
-            {
-                close(fd);
-                throw std::runtime_error("Physical mapping failed");
-            }
+            return Left != other.Left;
+        };
+    };
+
+    const std::byte *Data; // Header of the first message
+    size_t Count;          // Messages in the batch
+
+    Iterator begin() const
+    {
+        return Iterator{Data, Count};
+    };
+
+    Iterator end() const
+    {
+        return Iterator{nullptr, 0};
+    };
+
+    // Framed bytes of the whole batch
+    size_t GetBytes() const
+    {
+        const std::byte *pos = Data;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            pos += CMessageFrame<Align>::GetFramedSize(CMessageFrame<Align>::GetSize(pos));
         }
-        close(fd);
+        return pos - Data;
     };
 };
 
@@ -157,14 +631,25 @@ private:
 // VSize: Virtual buffer size. how big the buffer "feels like", default: 4GB. Previously: 16x the size of the underlying physical buffer. Must be a multiple of 4096.
 // PSize: Physical buffer size. how big the buffer actually is. By default (and as a minimum)
 //        we use your system's page size: sysconf(_SC_PAGESIZE)
+//
+// Head and Tail wrap at WrapSize, one view before the end of the virtual buffer,
+// so every record of up to PSize bytes is a single contiguous access: no split
+// copy at the end of the virtual buffer, however long the buffer runs.
+// With MirrorMode::Double the virtual buffer is just two views, and Head and Tail
+// wrap at PSize: every record still lands contiguous, in the first or second view.
 class CByteBuffer
 {
 public:
     size_t PSize;    // Physical buffer size (multiple of your page size, probably 4096)
     size_t VSize;  // Virtual buffer size, how much the buffer actually feels like (>= PSize)
+    size_t PageSize; // Page size backing the buffer (regular or huge)
     std::byte *Data; // Buffer
+    size_t WrapSize; // Head and Tail stay below this: all views but the last one (PSize in double mode)
     uint64_t Head;   // Buffer Head: next push
     uint64_t Tail;   // Buffer Tail: next pop
+    int Fd;          // memfd behind the views if Resizable, -1 otherwise
+    size_t PrefetchDistance = 0; // Pops prefetch this many bytes past Tail, 0 to not prefetch (at most PSize)
+    [[no_unique_address]] CBufferStatsType Stats; // Hot path counters, empty without CBUFFER_STATS
 
     // Physical size is one page, usually 4096 (default)
     // Virtual size is 4GB (default)
@@ -172,25 +657,27 @@ public:
                     VSize(4294967296)
                     // VSize(16*PSize)
     {
-        Allocate();
+        Allocate(CBufferOptions());
     };
 
     // Custom Physical size (must be multiple of page size)
     // Virtual size is 4GB (default)
-    CByteBuffer(size_t pbuffer_size_) : PSize(ToNextPageSize(pbuffer_size_)),
-                                        VSize(4294967296)
-                                        // VSize(16*PSize)
+    CByteBuffer(size_t pbuffer_size_,
+                const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                     VSize(4294967296)
+                                                                     // VSize(16*PSize)
     {
-        Allocate();
+        Allocate(options_);
     };
 
     // Custom Physical size (must be multiple of page size)
     // Custom Virtual size multiplier: is x times sizes of the physical buffer
     CByteBuffer(size_t pbuffer_size_,
-            uint8_t vbuffer_mult_) : PSize(ToNextPageSize(pbuffer_size_)),
-                                     VSize(vbuffer_mult_*PSize)
+            uint8_t vbuffer_mult_,
+            const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                 VSize(vbuffer_mult_*PSize)
     {
-        Allocate();
+        Allocate(options_);
     };
 
     ~CByteBuffer()
@@ -204,12 +691,14 @@ public:
             }
             Data = nullptr;
         }
+        if (Fd != -1) close(Fd);
     };
 
     void Reset()
     {
         Head=0;
         Tail=0;
+        Stats.Reset();
     };
 
     CByteBuffer(const CByteBuffer &) = delete;
@@ -231,93 +720,400 @@ public:
         return Data[index];
     };
 
+    // Puts `data` at head. sizeof(T) must be at most PSize.
     template <typename T>
     void Push(const T& data) {
         static_assert(std::is_trivially_copyable_v<T>);
 
-        if (__builtin_expect(Head + sizeof(T) < VSize, 1))
-        {    
-            // use a direct typed store instead of memcpy
-            *reinterpret_cast<T*>(&Data[Head]) = data;
-            Head += sizeof(T);
-        }
-        else
-        {
-            // the virtual buffer is not infinite, we need to manually
-            // manage the wraparound when the data wraps around the virtual.
-            // this happens very rarely, may never happen if you never exceed the virtual size
-            const std::byte* src = reinterpret_cast<const std::byte*>(&data);
-            size_t firstPart = VSize - Head;
-            size_t secondPart = sizeof(T) - firstPart;
-
-            std::memcpy(&Data[Head], src, firstPart);
-            std::memcpy(&Data[0], src + firstPart, secondPart);
-            Head = (Head + sizeof(T)) & (VSize - 1);
-        }
+        // Head is below WrapSize, a whole view before the end of the mirror:
+        // always a single contiguous store, whatever sizeof(T)
+        *reinterpret_cast<T*>(&Data[Head]) = data;
+        Head += sizeof(T);
+        if (Head >= WrapSize) Head -= WrapSize;
+        CountPush(sizeof(T));
     };
 
+    // Gets the T at tail. sizeof(T) must be at most PSize.
     template <typename T>
     T Pop() {
         static_assert(std::is_trivially_copyable_v<T>);
 
-        if (__builtin_expect(Tail + sizeof(T) < VSize, 1))
+        T data = *reinterpret_cast<const T*>(&Data[Tail]);
+        Prefetch(Tail, Tail + sizeof(T));
+        Tail += sizeof(T);
+        if (Tail >= WrapSize) Tail -= WrapSize;
+        CountPop(sizeof(T));
+        return data;
+    };
+
+    // Puts `data` at head, padded to `Align` bytes (a power of two, at most
+    // the page size), so records never straddle an `Align` boundary more than
+    // they have to: with the default, a record of up to 64 bytes sits in one
+    // cache line. Push and pop with the same `Align`, and keep Head on it.
+    template <size_t Align = CACHE_LINE_SIZE, typename T>
+    void PushAligned(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        static_assert((Align & (Align - 1)) == 0, "Align must be a power of two");
+        assert(Head % Align == 0);
+
+        // WrapSize is a multiple of the page size: rebasing keeps the alignment
+        constexpr size_t stride = (sizeof(T) + Align - 1) & ~(Align - 1);
+        *reinterpret_cast<T*>(&Data[Head]) = data;
+        Head += stride;
+        if (Head >= WrapSize) Head -= WrapSize;
+        CountPush(stride);
+    };
+
+    // Gets the T at tail, pushed with PushAligned<Align>()
+    template <typename T, size_t Align = CACHE_LINE_SIZE>
+    T PopAligned() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        static_assert((Align & (Align - 1)) == 0, "Align must be a power of two");
+        assert(Tail % Align == 0);
+
+        constexpr size_t stride = (sizeof(T) + Align - 1) & ~(Align - 1);
+        T data = *reinterpret_cast<const T*>(__builtin_assume_aligned(&Data[Tail], Align));
+        uint64_t tail = Tail + stride;
+        Prefetch(Tail, tail);
+        Tail = tail;
+        if (Tail >= WrapSize) Tail -= WrapSize;
+        CountPop(stride);
+        return data;
+    };
+
+    // Contiguous `n` bytes at head, to be written in place and published with
+    // Commit(). `n` must be at most PSize.
+    std::span<std::byte> Reserve(size_t n)
+    {
+        return std::span<std::byte>(&Data[Head], n);
+    };
+
+    // Publishes `n` bytes written through Reserve()
+    void Commit(size_t n)
+    {
+        Head += n;
+        if (Head >= WrapSize) Head -= WrapSize;
+        CountPush(n);
+    };
+
+    // Contiguous `n` bytes at tail, to be read in place and released with
+    // Consume(). `n` must be at most PSize.
+    std::span<const std::byte> Peek(size_t n)
+    {
+        return std::span<const std::byte>(&Data[Tail], n);
+    };
+
+    // Releases `n` bytes read through Peek()
+    void Consume(size_t n)
+    {
+        Tail += n;
+        if (Tail >= WrapSize) Tail -= WrapSize;
+        CountPop(n);
+    };
+
+    // Puts `n` items at head, with one index update.
+    // `n * sizeof(T)` must be at most PSize.
+    template <typename T>
+    void PushN(const T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        size_t bytes = n * sizeof(T);
+        BulkCopy(Reserve(bytes).data(), data, bytes);
+        Commit(bytes);
+    };
+
+    // Gets `n` items at tail, with one index update.
+    // `n * sizeof(T)` must be at most PSize.
+    template <typename T>
+    void PopN(T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        size_t bytes = n * sizeof(T);
+        BulkCopy(data, Peek(bytes).data(), bytes);
+        Consume(bytes);
+    };
+
+    // Reads up to `max` bytes (or as many as are free) from `fd` straight into
+    // the buffer, at head: one read(), the mirror makes the space contiguous.
+    // Returns the bytes read (Head moves by as much), 0 on end of file or when full, -1 on error (errno).
+    ssize_t ReadFrom(int fd, size_t max)
+    {
+        size_t free = PSize - GetUsed();
+        if (max > free) max = free;
+        if (max == 0) return 0;
+        ssize_t n = read(fd, Reserve(max).data(), max);
+        if (n > 0) Commit(n);
+        return n;
+    };
+
+    // Writes up to `max` bytes (or as many as are used) to `fd` straight from
+    // the buffer, at tail: one write().
+    // Returns the bytes written (Tail moves by as much), 0 when empty, -1 on error (errno).
+    ssize_t WriteTo(int fd, size_t max)
+    {
+        size_t used = GetUsed();
+        if (max > used) max = used;
+        if (max == 0) return 0;
+        ssize_t n = write(fd, Peek(max).data(), max);
+        if (n > 0) Consume(n);
+        return n;
+    };
+
+    // Puts `message` at head, length prefixed, see CMessageFrame. Push and pop
+    // with the same `Align`, and keep Head on it (no Push<T> in between).
+    // The framed message must be at most PSize.
+    template <size_t Align = 8>
+    void PushMessage(std::span<const std::byte> message)
+    {
+        using Frame = CMessageFrame<Align>;
+        size_t bytes = Frame::GetFramedSize(message.size());
+        std::byte *dst = Reserve(bytes).data();
+        uint32_t size = static_cast<uint32_t>(message.size());
+        std::memcpy(dst, &size, sizeof(uint32_t));
+        BulkCopy(dst + Frame::HEADER, message.data(), message.size());
+        Commit(bytes);
+    };
+
+    // Payload of the message at tail, contiguous, read in place.
+    // There must be one.
+    template <size_t Align = 8>
+    std::span<const std::byte> PeekMessage()
+    {
+        using Frame = CMessageFrame<Align>;
+        uint32_t size = Frame::GetSize(Peek(Frame::HEADER).data());
+        return Peek(Frame::GetFramedSize(size)).subspan(Frame::HEADER, size);
+    };
+
+    // Releases the message at tail, read through PeekMessage()
+    template <size_t Align = 8>
+    void PopMessage()
+    {
+        using Frame = CMessageFrame<Align>;
+        Consume(Frame::GetFramedSize(Frame::GetSize(Peek(Frame::HEADER).data())));
+    };
+
+    // The next `count` messages at tail, in place. There must be as many, and
+    // then Consume(batch.GetBytes()) releases them all at once.
+    template <size_t Align = 8>
+    CMessageBatch<Align> PeekMessages(size_t count)
+    {
+        // unread data is at most PSize: all of it is contiguous from tail
+        return CMessageBatch<Align>{Peek(PSize).data(), count};
+    };
+
+    // Bytes between Tail and Head. A buffer holding exactly PSize bytes reads
+    // as empty in double mode (Head and Tail meet).
+    size_t GetUsed() const
+    {
+        return Head >= Tail ? Head - Tail : Head + WrapSize - Tail;
+    };
+
+    // Counters since the last Reset(), all zeros without CBUFFER_STATS.
+    // Grow(), Shrink() and Trim() move no bytes in or out: not counted.
+    CBufferStatsSnapshot GetStats() const
+    {
+        return Stats.Snapshot();
+    };
+
+    // Resizable buffers only. Grows the physical buffer to at least `new_size`
+    // bytes (a multiple of PageSize), keeping the bytes between Tail and Head.
+    // The memfd is extended and the views rebuilt over it, the first one
+    // moved with mremap, so its pages stay mapped. Bytes only move when they
+    // straddle the old end of the physical buffer, and then only the shorter
+    // side of it. Pointers and spans into the buffer are invalidated.
+    // Options other than the mode (NUMA, Prefault, Lock) are not applied again.
+    void Grow(size_t new_size)
+    {
+        size_t psize = ToNextPageSize(new_size, PageSize);
+        if (Fd == -1)
         {
-            // use a direct typed store instead of memcpy
-            T data = *reinterpret_cast<const T*>(&Data[Tail]);
-            Tail += sizeof(T);
-            return data;
+            throw std::logic_error("CByteBuffer: Grow() needs CBufferOptions::Resizable");
         }
-        else
+        if (psize <= PSize) return;
+
+        size_t used = GetUsed();
+        size_t tail = Tail % PSize;
+        size_t old_psize = PSize;
+        if (ftruncate(Fd, psize) == -1)
+        {
+            throw std::runtime_error("ftruncate failed");
+        }
+        Remap(psize);
+
+        // the physical bytes did not move: the file only grew past old_psize
+        size_t first = old_psize - tail; // live bytes before the old end
+        if (used > first)
         {
-            // the virtual buffer is not infinite, we need to manually
-            // manage the wraparound when the data wraps around the virtual.
-            // this happens very rarely, may never happen if you never exceed the virtual size
-            T data;
-            size_t firstPart = VSize - Tail;
-            size_t secondPart = sizeof(T) - firstPart;
-            std::memcpy(&data, &Data[Tail], firstPart);
-            std::memcpy(reinterpret_cast<std::byte*>(&data) + firstPart, &Data[0], secondPart);
-            Tail = (Tail + sizeof(T)) & (VSize - 1);
-            return data;
+            size_t wrapped = used - first; // and after it, from 0
+            if (wrapped <= first && old_psize + wrapped <= PSize)
+            {
+                // move the wrapped part right after the old end
+                BulkCopy(&Data[old_psize], &Data[0], wrapped);
+            }
+            else
+            {
+                // move the part before the old end to the new end
+                std::memmove(&Data[PSize - first], &Data[tail], first);
+                tail = PSize - first;
+            }
         }
+        Tail = tail;
+        Head = tail + used;
+        if (Head >= WrapSize) Head -= WrapSize;
     };
 
-private:
-    void Allocate()
+    // Resizable buffers only. Shrinks the physical buffer to `new_size` bytes
+    // (a multiple of PageSize), or to the bytes between Tail and Head if more,
+    // and gives the pages past it back to the system: RSS drops.
+    // The live bytes move to the start of the buffer if they lie past the new
+    // end. Pointers and spans into the buffer are invalidated.
+    void Shrink(size_t new_size)
     {
-        Head = 0;
-        Tail = 0;
-        if (VSize < PSize)
+        if (Fd == -1)
         {
-            VSize = PSize;
+            throw std::logic_error("CByteBuffer: Shrink() needs CBufferOptions::Resizable");
         }
-        if (PSize == 4096) VSize = 4294803456; // hotfix: my cpu is not allowing bigger VSize
+        size_t used = GetUsed();
+        size_t psize = ToNextPageSize(new_size > used ? new_size : used, PageSize);
+        if (psize >= PSize) return;
 
-        void *Base = mmap(NULL, VSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (Base == MAP_FAILED)
+        size_t tail = Tail % PSize;
+        if (tail + used > psize)
+        {
+            // contiguous through the mirror, but it may overlap its own
+            // destination through another view: go through a copy
+            std::unique_ptr<std::byte[]> live(new std::byte[used]);
+            BulkCopy(live.get(), &Data[Tail], used);
+            BulkCopy(&Data[0], live.get(), used);
+            tail = 0;
+        }
+        Remap(psize);
+        if (ftruncate(Fd, psize) == -1)
         {
-            throw std::runtime_error("Virtual reservation failed");
+            throw std::runtime_error("ftruncate failed");
         }
-        Data = static_cast<std::byte*>(Base);
+        Tail = tail;
+        Head = tail + used;
+        if (Head >= WrapSize) Head -= WrapSize;
+    };
+
+    // Gives back the pages of the physical buffer holding no live bytes
+    // (outside Tail to Head): they read as zeros and fault in again on the
+    // next write. PSize stays the same. Punches a hole in the memfd if
+    // Resizable, MADV_REMOVE on the first view otherwise.
+    // Returns the bytes released.
+    size_t Trim()
+    {
+        size_t tail = Tail % PSize;
+        size_t start = (tail + GetUsed() + PageSize - 1) / PageSize * PageSize; // first free page
+        size_t end = (tail + PSize) / PageSize * PageSize;         // past the last one
+        if (end <= start) return 0;
+
+        // free pages run from `start` up to the page holding Tail, through the end
+        size_t offset = start % PSize;
+        size_t bytes = end - start;
+        size_t before_end = PSize - offset < bytes ? PSize - offset : bytes;
+        Release(offset, before_end);
+        if (bytes > before_end) Release(0, bytes - before_end);
+        return bytes;
+    };
 
-        int fd = memfd_create("CByteBuffer", 0);
-        if (fd == -1)
+private:
+    MirrorMode Mode; // Kept for Remap()
+
+    // After Head moved `n` bytes. CByteBuffer never refuses a push: a full
+    // stall is one that overwrote bytes not popped yet. The index wrapped
+    // if it ended up below `n`: the rebase at WrapSize.
+    void CountPush(size_t n)
+    {
+        uint64_t held = Stats.GetHeld() + n;
+        if (held > PSize)
         {
-            throw std::runtime_error("memfd_create failed");
+            Stats.FullStall();
+            held = PSize;
         }
-        ftruncate(fd, PSize);
+        Stats.Pushed(n, held, Head < n);
+    };
+
+    // After Tail moved `n` bytes. An empty stall read past Head.
+    void CountPop(size_t n)
+    {
+        if (Stats.GetHeld() < n) Stats.EmptyStall();
+        Stats.Popped(n, Tail < n);
+    };
 
-        for (size_t i = 0; i < GetPageCount(); ++i)
+    // One prefetch per cache line popped, PrefetchDistance past the new tail.
+    // Straight through the mirror: the seam is just the next view, no wrap.
+    void Prefetch(uint64_t tail, uint64_t next) const
+    {
+        if (PrefetchDistance != 0 && (tail ^ next) >= CACHE_LINE_SIZE)
         {
-            void *addr = (char *)Base + (i * PSize);
-            if (mmap(addr, PSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+            _mm_prefetch(reinterpret_cast<const char *>(&Data[next + PrefetchDistance]), _MM_HINT_T0);
+        }
+    };
+
+    // Rebuilds the views over `psize` bytes of Fd: a new reservation, every
+    // view past the first mapped again, then the first one moved there with
+    // mremap (grown or shrunk, its page tables kept). The old views go last,
+    // so a failure before the mremap leaves the buffer as it was.
+    void Remap(size_t psize)
+    {
+        size_t vsize = Mode == MirrorMode::Double ? 2*psize : VSize / psize * psize;
+        if (vsize < 2*psize) vsize = 2*psize;
+        size_t huge_page_size = PageSize == (size_t)sysconf(_SC_PAGESIZE) ? 0 : PageSize;
+
+        char *base = static_cast<char *>(ReserveMirror(vsize, huge_page_size));
+        for (size_t i = 1; i < vsize / psize; ++i)
+        {
+            if (mmap(base + i * psize, psize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, Fd, 0) == MAP_FAILED)
             {
-                munmap(Data, VSize); // try to unmap, otherwise will not exit probram
-                close(fd);
+                munmap(base, vsize);
                 throw std::runtime_error("Physical mapping failed");
             }
         }
-        close(fd);
+        if (mremap(Data, PSize, psize, MREMAP_MAYMOVE | MREMAP_FIXED, base) == MAP_FAILED &&
+            mmap(base, psize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, Fd, 0) == MAP_FAILED)
+        {
+            munmap(base, vsize);
+            throw std::runtime_error("Physical mapping failed");
+        }
+        munmap(Data, VSize); // what is left of the old views
+
+        Data = reinterpret_cast<std::byte *>(base);
+        PSize = psize;
+        VSize = vsize;
+        WrapSize = (VSize / PSize - 1) * PSize;
+    };
+
+    // Frees `bytes` of the physical buffer at `offset` (page aligned)
+    void Release(size_t offset, size_t bytes)
+    {
+        int ret = Fd != -1 ? fallocate(Fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, bytes)
+                           : madvise(&Data[offset], bytes, MADV_REMOVE);
+        if (ret == -1)
+        {
+            throw std::runtime_error("Releasing pages failed");
+        }
+    };
+
+    void Allocate(const CBufferOptions &options)
+    {
+        Head = 0;
+        Tail = 0;
+        Fd = -1;
+        Mode = options.Mode;
+        // at least two views, so any access of up to PSize bytes is contiguous
+        if (options.Mode == MirrorMode::Double || VSize < 2*PSize) VSize = 2*PSize;
+        // hotfix: my cpu is not allowing bigger VSize. Only for the 4GB default,
+        // an explicit multiplier (or double mode) is kept as asked.
+        if (PSize == 4096 && VSize == 4294967296) VSize = 4294803456;
+
+        Data = static_cast<std::byte*>(AllocateMirror(PSize, VSize, PageSize, "CByteBuffer", options,
+                                                      options.Resizable ? &Fd : nullptr));
+        // indices are rebased a whole view before the end of the mirror, PSize
+        // bytes at a time, so they stay the same modulo PSize (same physical byte),
+        // and every access from below WrapSize fits in the last view.
+        WrapSize = (VSize / PSize - 1) * PSize;
     };
 };
 
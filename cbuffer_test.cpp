@@ -1,6 +1,20 @@
 #include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <list>
 #include "cbuffer.hpp"
 #include "buffer.hpp"
+#include "cqueue.hpp"
+#include "cpool.hpp"
+#include "cipc.hpp"
+#include "curing.hpp"
+#include "clossy.hpp"
+#include "cwindow.hpp"
+#include "ccolumn.hpp"
+#include "cjournal.hpp"
+#include "cpipeline.hpp"
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 // Test that the memory actually mirrors
 TEST(CBufferTest, VirtualAliasing) {
@@ -115,3 +129,1445 @@ TEST(ByteBufferTest, Wraparound) {
     EXPECT_EQ(t_bis.f, t_.f);
     EXPECT_EQ(t_bis.g, t_.g);
 }
+
+TEST(CSpscByteBufferTest, FullEmpty) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CSpscByteBuffer qbuf(page_size);
+    EXPECT_TRUE(qbuf.IsEmpty());
+    EXPECT_EQ(qbuf.GetPushable(), page_size);
+
+    uint64_t v;
+    EXPECT_FALSE(qbuf.TryPop(v));
+    for (uint64_t i = 0; i < page_size / sizeof(uint64_t); ++i) {
+        EXPECT_TRUE(qbuf.TryPush(i));
+    }
+    EXPECT_TRUE(qbuf.IsFull());
+    EXPECT_FALSE(qbuf.TryPush(v));
+
+    EXPECT_TRUE(qbuf.TryPop(v));
+    EXPECT_EQ(v, 0u);
+    EXPECT_EQ(qbuf.GetPushable(), sizeof(uint64_t));
+}
+
+TEST(CSpscByteBufferTest, Wraparound) {
+    Sarasa t_ = {918243,123443,12,61,0,true,true};
+    CSpscByteBuffer qbuf;
+    // odd sized records straddle the end of the physical buffer
+    for (int i = 0; i < 1024; ++i) {
+        ASSERT_TRUE(qbuf.TryPush<Sarasa>(t_));
+        Sarasa t_bis;
+        ASSERT_TRUE(qbuf.TryPop<Sarasa>(t_bis));
+        EXPECT_EQ(t_bis.a, t_.a);
+        EXPECT_EQ(t_bis.g, t_.g);
+    }
+    EXPECT_TRUE(qbuf.IsEmpty());
+}
+
+TEST(CSpscByteBufferTest, ProducerConsumer) {
+    const uint64_t n = 100000;
+    CSpscByteBuffer qbuf;
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < n; ++i) {
+            while (!qbuf.TryPush(i)) std::this_thread::yield();
+        }
+    });
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t v;
+        while (!qbuf.TryPop(v)) std::this_thread::yield();
+        ASSERT_EQ(v, i);
+    }
+    producer.join();
+    EXPECT_TRUE(qbuf.IsEmpty());
+}
+
+TEST(CMpmcBufferTest, FullEmptyBatch) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CMpmcBuffer<uint32_t> queue(page_size / sizeof(uint32_t));
+    ASSERT_EQ(queue.Capacity, page_size / sizeof(uint32_t));
+
+    uint32_t v;
+    EXPECT_FALSE(queue.TryPop(v));
+
+    // batches straddling the end of the physical buffer
+    uint32_t in[100], out[100];
+    uint32_t next_in = 0, next_out = 0;
+    for (int lap = 0; lap < 100; ++lap) {
+        for (auto &x : in) x = next_in++;
+        ASSERT_TRUE(queue.TryPushN(in, 100));
+        ASSERT_TRUE(queue.TryPopN(out, 100));
+        for (auto x : out) ASSERT_EQ(x, next_out++);
+    }
+
+    for (size_t i = 0; i < queue.Capacity; ++i) {
+        ASSERT_TRUE(queue.TryPush(static_cast<uint32_t>(i)));
+    }
+    EXPECT_FALSE(queue.TryPush(v));
+    EXPECT_FALSE(queue.TryPushN(in, 1));
+    EXPECT_EQ(queue.GetSize(), queue.Capacity);
+}
+
+TEST(CMpmcBufferTest, ProducersConsumers) {
+    const int threads = 4;
+    const uint64_t per_thread = 20000;
+    CMpmcBuffer<uint64_t> queue(1024);
+    std::atomic<uint64_t> sum(0);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (uint64_t i = 0; i < per_thread; ++i) {
+                while (!queue.TryPush(t * per_thread + i)) std::this_thread::yield();
+            }
+        });
+        workers.emplace_back([&]() {
+            uint64_t local = 0, v;
+            for (uint64_t i = 0; i < per_thread; ++i) {
+                while (!queue.TryPop(v)) std::this_thread::yield();
+                local += v;
+            }
+            sum += local;
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    uint64_t n = threads * per_thread;
+    EXPECT_EQ(sum.load(), n * (n - 1) / 2);
+    EXPECT_EQ(queue.GetSize(), 0u);
+}
+
+TEST(CByteBufferTest, ReserveCommitPeekConsume) {
+    CByteBuffer bbuf(2*4096, 2);
+    const size_t n = 3000; // does not divide VSize, reservations hit the end of it
+    for (int i = 0; i < 100; ++i) {
+        auto out = bbuf.Reserve(n);
+        ASSERT_EQ(out.size(), n);
+        std::memset(out.data(), i, n);
+        bbuf.Commit(n);
+
+        auto in = bbuf.Peek(n);
+        ASSERT_EQ(in.size(), n);
+        EXPECT_EQ(in[0], std::byte(i));
+        EXPECT_EQ(in[n-1], std::byte(i));
+        bbuf.Consume(n);
+        EXPECT_LE(bbuf.Head, bbuf.VSize);
+    }
+}
+
+TEST(CSpscByteBufferTest, ReserveCommitPeekConsume) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CSpscByteBuffer qbuf(page_size);
+    const size_t n = 1000;
+    EXPECT_TRUE(qbuf.Peek(1).empty());
+    for (int i = 0; i < 100; ++i) {
+        auto out = qbuf.Reserve(n);
+        ASSERT_EQ(out.size(), n);
+        std::memset(out.data(), i, n);
+        qbuf.Commit(n);
+        EXPECT_TRUE(qbuf.Peek(n + 1).empty());
+
+        auto in = qbuf.Peek(n);
+        ASSERT_EQ(in.size(), n);
+        EXPECT_EQ(in[0], std::byte(i));
+        EXPECT_EQ(in[n-1], std::byte(i));
+        qbuf.Consume(n);
+    }
+    EXPECT_TRUE(qbuf.Reserve(page_size + 1).empty());
+    EXPECT_EQ(qbuf.Reserve(page_size).size(), page_size);
+}
+
+TEST(BulkCopyTest, AllSizes) {
+    std::vector<uint8_t> src(3 << 20), dst(src.size() + 64);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = static_cast<uint8_t>(i * 7);
+    // small, vector, and streaming sizes, unaligned destinations
+    for (size_t n : {0ul, 1ul, 255ul, 256ul, 1000ul, 4096ul + 3, src.size()}) {
+        for (size_t off : {0ul, 1ul, 33ul}) {
+            std::fill(dst.begin(), dst.end(), 0);
+            BulkCopy(dst.data() + off, src.data(), n);
+            ASSERT_EQ(std::memcmp(dst.data() + off, src.data(), n), 0);
+            ASSERT_EQ(dst[off + n], 0);
+        }
+    }
+}
+
+TEST(ByteBufferTest, PushNPopN) {
+    ByteBuffer bbuf(4096);
+    uint32_t in[300], out[300];
+    uint32_t next_in = 0, next_out = 0;
+    // 1200 bytes per batch, wraps every few laps
+    for (int lap = 0; lap < 20; ++lap) {
+        for (auto &x : in) x = next_in++;
+        bbuf.PushN(in, 300);
+        bbuf.PopN(out, 300);
+        for (auto x : out) ASSERT_EQ(x, next_out++);
+    }
+}
+
+TEST(CByteBufferTest, PushNPopN) {
+    CByteBuffer bbuf(2*4096, 2);
+    uint32_t in[500], out[500];
+    uint32_t next_in = 0, next_out = 0;
+    for (int lap = 0; lap < 20; ++lap) {
+        for (auto &x : in) x = next_in++;
+        bbuf.PushN(in, 500);
+        bbuf.PopN(out, 500);
+        for (auto x : out) ASSERT_EQ(x, next_out++);
+    }
+}
+
+TEST(CBufferTest, WriteNReadN) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CBuffer<uint32_t> buf(page_size);
+    Buffer<uint32_t> classic(page_size / sizeof(uint32_t));
+    size_t items = buf.GetPItemCount();
+    std::vector<uint32_t> in(items), out(items);
+    for (size_t i = 0; i < items; ++i) in[i] = i;
+
+    // starting half way, wraps over the end of the physical buffer
+    buf.WriteN(items / 2, in.data(), items);
+    classic.WriteN(items / 2, in.data(), items);
+    EXPECT_EQ(buf[0], in[items / 2]);
+    EXPECT_EQ(classic[0], in[items / 2]);
+
+    buf.ReadN(items / 2, out.data(), items);
+    EXPECT_EQ(out, in);
+    classic.ReadN(items / 2, out.data(), items);
+    EXPECT_EQ(out, in);
+}
+
+TEST(CSpscByteBufferTest, PushNPopN) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CSpscByteBuffer qbuf(page_size);
+    std::vector<uint32_t> in(page_size / sizeof(uint32_t) + 1), out(in.size());
+    EXPECT_FALSE(qbuf.TryPushN(in.data(), in.size()));
+    for (size_t i = 0; i < in.size(); ++i) in[i] = i;
+    for (int lap = 0; lap < 20; ++lap) {
+        ASSERT_TRUE(qbuf.TryPushN(in.data(), 300));
+        EXPECT_FALSE(qbuf.TryPopN(out.data(), 301));
+        ASSERT_TRUE(qbuf.TryPopN(out.data(), 300));
+        ASSERT_EQ(std::memcmp(in.data(), out.data(), 300 * sizeof(uint32_t)), 0);
+    }
+}
+
+// Huge pages are usually not reserved on test machines, both outcomes must mirror
+TEST(CBufferTest, HugePages) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CBufferOptions options;
+    options.HugePageSize = HUGE_PAGE_2MB;
+    CBuffer<int> buf(page_size, options);
+    EXPECT_TRUE(buf.PageSize == HUGE_PAGE_2MB || buf.PageSize == page_size);
+    EXPECT_EQ(buf.PSize % buf.PageSize, 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(buf.Data) % buf.PageSize, 0u);
+
+    buf[0] = 1234;
+    EXPECT_EQ(buf[buf.GetPItemCount()], 1234);
+
+    EXPECT_EQ(ToNextPageSize(3 << 20, HUGE_PAGE_2MB), 2 * HUGE_PAGE_2MB);
+}
+
+TEST(CByteBufferTest, HugePages) {
+    CBufferOptions options;
+    options.HugePageSize = HUGE_PAGE_2MB;
+    CByteBuffer bbuf(HUGE_PAGE_2MB, 2, options);
+    EXPECT_EQ(bbuf.PSize, HUGE_PAGE_2MB);
+    bbuf.Push<uint64_t>(42);
+    EXPECT_EQ(bbuf.Pop<uint64_t>(), 42u);
+}
+
+TEST(CByteBufferTest, DoubleMapping) {
+    Sarasa t_ = {918243,123443,12,61,0,true,true};
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+    CByteBuffer bbuf(4096, options);
+    EXPECT_EQ(bbuf.VSize, 2 * bbuf.PSize);
+    EXPECT_EQ(bbuf.GetPageCount(), 2u);
+
+    // many laps around the physical buffer, odd sized records straddle it
+    for (int i = 0; i < 10000; ++i) {
+        t_.a = i;
+        bbuf.Push<Sarasa>(t_);
+        auto t_bis = bbuf.Pop<Sarasa>();
+        ASSERT_EQ(t_bis.a, t_.a);
+        ASSERT_LT(bbuf.Head, bbuf.PSize);
+        ASSERT_LT(bbuf.Tail, bbuf.PSize);
+    }
+}
+
+TEST(CBufferTest, DoubleMapping) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+    CBuffer<int> buf(page_size, options);
+    EXPECT_EQ(buf.GetPageCount(), 2u);
+    buf[buf.GetPItemCount()] = 42;
+    EXPECT_EQ(buf[0], 42);
+}
+
+TEST(CBufferPoolTest, AcquireRelease) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CBufferPool pool({4 * page_size, page_size}, 2);
+    EXPECT_EQ(pool.GetFreeCount(page_size), 2u);
+
+    CByteBuffer *a = pool.Acquire(page_size);
+    CByteBuffer *b = pool.Acquire(page_size);
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(a->PSize, page_size);
+    EXPECT_EQ(a->GetPageCount(), 2u);
+
+    // small class exhausted: falls back to the bigger one
+    CByteBuffer *c = pool.Acquire(page_size);
+    ASSERT_NE(c, nullptr);
+    EXPECT_EQ(c->PSize, 4 * page_size);
+    EXPECT_EQ(pool.Acquire(8 * page_size), nullptr);
+
+    a->Push<uint64_t>(42);
+    pool.Release(a);
+    EXPECT_EQ(pool.GetFreeCount(page_size), 1u);
+    CByteBuffer *d = pool.Acquire(page_size);
+    EXPECT_EQ(d, a);
+    EXPECT_EQ(d->Head, 0u);
+
+    CByteBuffer outsider(page_size, CBufferOptions{MirrorMode::Double});
+    EXPECT_THROW(pool.Release(&outsider), std::invalid_argument);
+}
+
+TEST(CBufferPoolTest, Concurrent) {
+    CBufferPool pool({4096}, 8);
+    std::vector<std::thread> workers;
+    std::atomic<int> failures(0);
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&]() {
+            for (int i = 0; i < 10000; ++i) {
+                CByteBuffer *buf = pool.Acquire(4096);
+                if (buf == nullptr) { ++failures; continue; }
+                buf->Push<uint32_t>(i);
+                if (buf->Pop<uint32_t>() != static_cast<uint32_t>(i)) ++failures;
+                pool.Release(buf);
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(pool.GetFreeCount(4096), 8u);
+}
+
+// Minor page faults taken by this thread writing one byte per page of
+// [data, data + bytes): write faults, the kernel maps no pages around them
+static long FirstLapFaults(void *data, size_t bytes, size_t page_size)
+{
+    struct rusage before, after;
+    getrusage(RUSAGE_THREAD, &before);
+    for (size_t i = 0; i < bytes; i += page_size) static_cast<volatile char *>(data)[i] = 1;
+    getrusage(RUSAGE_THREAD, &after);
+    return after.ru_minflt - before.ru_minflt;
+}
+
+TEST(CByteBufferTest, NumaPopulate) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CBufferOptions options;
+    options.Mode = MirrorMode::Double;
+    options.NumaNode = 0;
+    options.Populate = true;
+    CByteBuffer bbuf(4 * page_size, options);
+
+    // the first view takes no page fault on the first lap, a plain buffer one per page
+    EXPECT_EQ(FirstLapFaults(bbuf.Data, bbuf.PSize, page_size), 0);
+    CBufferOptions plain;
+    plain.Mode = MirrorMode::Double;
+    CByteBuffer control(4 * page_size, plain);
+    EXPECT_GE(FirstLapFaults(control.Data, control.PSize, page_size), 4);
+
+    bbuf.Push<uint64_t>(42);
+    EXPECT_EQ(bbuf.Pop<uint64_t>(), 42u);
+
+    options.NumaNode = 4096;
+    EXPECT_THROW(CByteBuffer(page_size, options), std::invalid_argument);
+}
+
+TEST(CBufferTest, PrefaultLock) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CBufferOptions options;
+    options.Prefault = true;
+    CBuffer<int> buf(4 * page_size, 4, options);
+
+    // every page of every view is mapped before the first lap: no faults,
+    // where a plain buffer takes one per page per view
+    EXPECT_EQ(FirstLapFaults(buf.Data, buf.VSize, page_size), 0);
+    CBuffer<int> control(4 * page_size, 4);
+    EXPECT_GE(FirstLapFaults(control.Data, control.VSize, page_size), 16);
+
+    options.Prefault = false;
+    options.Lock = true;
+    CBuffer<int> locked(page_size, 4, options);
+    locked[0] = 5;
+    EXPECT_EQ(locked[3 * locked.GetPItemCount()], 5);
+}
+
+TEST(CIpcByteBufferTest, AttachForked) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CIpcByteBuffer ring = CIpcByteBuffer::Create(page_size);
+    const uint64_t n = 100000;
+
+    pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0)
+    {
+        // child: own views of the same pages, pushes through the mirror
+        CIpcByteBuffer producer = CIpcByteBuffer::Attach(ring.Fd);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            while (!producer.TryPush(i)) std::this_thread::yield();
+        }
+        _exit(0);
+    }
+
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        uint64_t v;
+        while (!ring.TryPop(v)) std::this_thread::yield();
+        ASSERT_EQ(v, i);
+    }
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_TRUE(ring.IsEmpty());
+}
+
+TEST(CIpcByteBufferTest, AttachByName) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const char *name = "/cbuffer_test_ipc";
+    shm_unlink(name);
+    {
+        CIpcByteBuffer producer = CIpcByteBuffer::Create(2 * page_size, name);
+        CIpcByteBuffer consumer = CIpcByteBuffer::Attach(name);
+        EXPECT_EQ(consumer.PSize, 2 * page_size);
+        EXPECT_THROW(CIpcByteBuffer::Create(page_size, name), std::runtime_error);
+
+        // in place across the end of the physical buffer
+        producer.Commit(2 * page_size - 8);
+        consumer.Consume(2 * page_size - 8);
+        std::span<std::byte> out = producer.Reserve(16);
+        ASSERT_EQ(out.size(), 16u);
+        for (size_t i = 0; i < 16; ++i) out[i] = std::byte(i);
+        producer.Commit(16);
+
+        std::span<const std::byte> in = consumer.Peek(16);
+        ASSERT_EQ(in.size(), 16u);
+        for (size_t i = 0; i < 16; ++i) EXPECT_EQ(in[i], std::byte(i));
+        consumer.Consume(16);
+        EXPECT_TRUE(producer.IsEmpty());
+    }
+    // the creator removed the name
+    EXPECT_THROW(CIpcByteBuffer::Attach(name), std::runtime_error);
+
+    int fd = memfd_create("not_a_ring", 0);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(ftruncate(fd, 2 * page_size), 0);
+    EXPECT_THROW(CIpcByteBuffer::Attach(fd), std::invalid_argument);
+    close(fd);
+}
+
+TEST(CByteBufferTest, ReadFromWriteTo) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<char> msg(page_size / 2);
+    for (size_t i = 0; i < msg.size(); ++i) msg[i] = static_cast<char>(i * 7);
+
+    // one read() across the end of the physical buffer, thanks to the mirror
+    CByteBuffer buf(page_size, CBufferOptions{MirrorMode::Double});
+    buf.Commit(page_size - 100);
+    buf.Consume(page_size - 100);
+    ASSERT_EQ(write(fds[1], msg.data(), msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(buf.ReadFrom(fds[0], msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(buf.WriteTo(fds[1], msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(buf.Head, buf.Tail);
+    std::vector<char> out(msg.size());
+    ASSERT_EQ(read(fds[0], out.data(), out.size()), (ssize_t)out.size());
+    EXPECT_EQ(out, msg);
+
+    // bounded by the used and free bytes: no stale bytes from past head,
+    // no overwriting unread ones
+    CByteBuffer vbuf(page_size, (uint8_t)4);
+    vbuf.Push<uint64_t>(0x1122334455667788);
+    EXPECT_EQ(vbuf.WriteTo(fds[1], vbuf.PSize), (ssize_t)sizeof(uint64_t));
+    EXPECT_EQ(vbuf.Head, vbuf.Tail);
+    EXPECT_EQ(vbuf.WriteTo(fds[1], vbuf.PSize), 0);
+    uint64_t word;
+    ASSERT_EQ(read(fds[0], &word, sizeof(word)), (ssize_t)sizeof(word));
+    EXPECT_EQ(word, 0x1122334455667788u);
+    vbuf.Commit(vbuf.PSize - 100);
+    ASSERT_EQ(write(fds[1], msg.data(), msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(vbuf.ReadFrom(fds[0], msg.size()), 100);
+    EXPECT_EQ(vbuf.GetUsed(), vbuf.PSize);
+    EXPECT_EQ(vbuf.ReadFrom(fds[0], msg.size()), 0);
+    ASSERT_EQ(read(fds[0], out.data(), msg.size() - 100), (ssize_t)msg.size() - 100);
+
+    // two iovecs across the wrap point
+    ByteBuffer bbuf(page_size);
+    bbuf.Head = bbuf.Tail = page_size - 100;
+    ASSERT_EQ(write(fds[1], msg.data(), msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(bbuf.ReadFrom(fds[0], msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(bbuf.Head, msg.size() - 100);
+    bbuf.PopN(out.data(), out.size());
+    EXPECT_EQ(out, msg);
+
+    // bounded by the free space, and by the ready bytes
+    CSpscByteBuffer queue(page_size);
+    queue.Commit(page_size - 100);
+    ASSERT_EQ(write(fds[1], msg.data(), msg.size()), (ssize_t)msg.size());
+    EXPECT_EQ(queue.ReadFrom(fds[0], msg.size()), 100);
+    queue.Consume(page_size - 100);
+    EXPECT_EQ(queue.ReadFrom(fds[0], msg.size()), (ssize_t)msg.size() - 100);
+    EXPECT_EQ(queue.WriteTo(fds[1], page_size), (ssize_t)msg.size());
+    ASSERT_EQ(read(fds[0], out.data(), out.size()), (ssize_t)out.size());
+    EXPECT_EQ(out, msg);
+    EXPECT_EQ(queue.WriteTo(fds[1], page_size), 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CUringReaderTest, Stream) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<char> msg(40000);
+    for (size_t i = 0; i < msg.size(); ++i) msg[i] = static_cast<char>(i * 13);
+    ASSERT_EQ(write(fds[1], msg.data(), msg.size()), (ssize_t)msg.size());
+    close(fds[1]);
+
+    CSpscByteBuffer buffer(4 * page_size);
+    std::unique_ptr<CUringReader> reader;
+    try
+    {
+        reader = std::make_unique<CUringReader>(buffer, fds[0], 3000, 4);
+    }
+    catch (const std::runtime_error &)
+    {
+        close(fds[0]);
+        GTEST_SKIP() << "io_uring not available";
+    }
+
+    // committed in order, across short reads and the wrap
+    std::vector<char> out;
+    while (!reader->Eof || reader->GetInFlight())
+    {
+        reader->Poll(true);
+        size_t n = buffer.GetPoppable();
+        std::span<const std::byte> in = buffer.Peek(n);
+        out.insert(out.end(), reinterpret_cast<const char *>(in.data()), reinterpret_cast<const char *>(in.data()) + n);
+        buffer.Consume(n);
+    }
+    EXPECT_EQ(reader->Error, 0);
+    EXPECT_EQ(out, msg);
+    close(fds[0]);
+}
+
+TEST(CUringReaderTest, File) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    FILE *file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    std::vector<uint32_t> msg(10000);
+    for (size_t i = 0; i < msg.size(); ++i) msg[i] = i;
+    ASSERT_EQ(fwrite(msg.data(), sizeof(uint32_t), msg.size(), file), msg.size());
+    fflush(file);
+
+    CSpscByteBuffer buffer(16 * page_size);
+    std::unique_ptr<CUringReader> reader;
+    try
+    {
+        reader = std::make_unique<CUringReader>(buffer, fileno(file), page_size, 8, 0);
+    }
+    catch (const std::runtime_error &)
+    {
+        fclose(file);
+        GTEST_SKIP() << "io_uring not available";
+    }
+
+    // parallel reads, the whole file fits
+    while (!reader->Eof || reader->GetInFlight()) reader->Poll(true);
+    EXPECT_EQ(reader->Error, 0);
+    ASSERT_EQ(buffer.GetPoppable(), msg.size() * sizeof(uint32_t));
+    std::vector<uint32_t> out(msg.size());
+    ASSERT_TRUE(buffer.TryPopN(out.data(), out.size()));
+    EXPECT_EQ(out, msg);
+    fclose(file);
+}
+
+TEST(CLossyByteBufferTest, OverwriteOldest) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CLossyByteBuffer lossy(page_size);
+
+    // records of 8 to 107 bytes, far more than fit: the oldest go, whole
+    const size_t count = 1000;
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::vector<std::byte> record(8 + i % 100, std::byte(i));
+        lossy.Push(record.data(), record.size());
+        EXPECT_LE(lossy.GetSize(), page_size);
+    }
+    EXPECT_GT(lossy.Dropped, 0u);
+
+    // the oldest record left is the first one not dropped
+    std::span<const std::byte> front = lossy.Front();
+    EXPECT_EQ(front.size(), 8 + lossy.Dropped % 100);
+    EXPECT_EQ(front[0], std::byte(lossy.Dropped));
+
+    // the newest records, contiguous through the mirror, oldest first
+    std::span<const std::byte> snapshot = lossy.Snapshot(1024);
+    EXPECT_LE(snapshot.size(), 1024u);
+    std::vector<std::span<const std::byte>> newest;
+    while (!snapshot.empty()) newest.push_back(CLossyByteBuffer::NextRecord(snapshot));
+    ASSERT_FALSE(newest.empty());
+    for (size_t k = 0; k < newest.size(); ++k)
+    {
+        size_t i = count - newest.size() + k;
+        ASSERT_EQ(newest[k].size(), 8 + i % 100);
+        EXPECT_EQ(newest[k].back(), std::byte(i));
+    }
+
+    lossy.PopFront();
+    EXPECT_EQ(lossy.Front()[0], std::byte(lossy.Dropped + 1));
+    EXPECT_THROW(lossy.Push(nullptr, page_size), std::invalid_argument);
+}
+
+TEST(CByteBufferTest, Messages) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    CByteBuffer buf(page_size, CBufferOptions{MirrorMode::Double});
+    std::vector<std::byte> msg(1000);
+    for (size_t i = 0; i < msg.size(); ++i) msg[i] = std::byte(i);
+
+    // one by one, across the end of the physical buffer many times
+    for (size_t i = 0; i < 100; ++i)
+    {
+        size_t size = 1 + (i * 37) % msg.size();
+        buf.PushMessage<16>(std::span<const std::byte>(msg.data(), size));
+        std::span<const std::byte> in = buf.PeekMessage<16>();
+        ASSERT_EQ(in.size(), size);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(in.data()) % 16, 0u);
+        EXPECT_EQ(std::memcmp(in.data(), msg.data(), size), 0);
+        buf.PopMessage<16>();
+        EXPECT_EQ(buf.Head, buf.Tail);
+    }
+
+    // in batches
+    for (size_t round = 0; round < 10; ++round)
+    {
+        for (size_t i = 0; i < 10; ++i)
+        {
+            buf.PushMessage(std::span<const std::byte>(msg.data() + i, 8 * i + round));
+        }
+        CMessageBatch<8> batch = buf.PeekMessages(10);
+        size_t i = 0;
+        for (std::span<const std::byte> in : batch)
+        {
+            ASSERT_EQ(in.size(), 8 * i + round);
+            if (!in.empty())
+            {
+                EXPECT_EQ(in[0], std::byte(i));
+            }
+            ++i;
+        }
+        EXPECT_EQ(i, 10u);
+        buf.Consume(batch.GetBytes());
+        EXPECT_EQ(buf.Head, buf.Tail);
+    }
+}
+
+TEST(StaticByteBufferTest, Wraparound) {
+    StaticByteBuffer<4096> sbuf;
+    std::vector<uint64_t> values(300);
+    for (size_t i = 0; i < values.size(); ++i) values[i] = i * 31;
+
+    // items split at the end of the buffer, then a bulk copy across it
+    for (uint32_t i = 0; i < 1500; ++i)
+    {
+        sbuf.Push<uint32_t>(i);
+        sbuf.Push<uint8_t>(i & 0xff);
+        EXPECT_EQ(sbuf.Pop<uint32_t>(), i);
+        EXPECT_EQ(sbuf.Pop<uint8_t>(), i & 0xff);
+    }
+    sbuf.PushN(values.data(), values.size());
+    std::vector<uint64_t> out(values.size());
+    sbuf.PopN(out.data(), out.size());
+    EXPECT_EQ(out, values);
+    EXPECT_EQ(sbuf.Head, sbuf.Tail);
+}
+
+TEST(StaticBufferTest, Indexing) {
+    StaticBuffer<int, 1024> sbuf;
+    static_assert(StaticBuffer<int, 1024>::GetSize() == 4096);
+    sbuf[5] = 42;
+    EXPECT_EQ(sbuf[1024 + 5], 42);
+
+    std::vector<int> values(100, 7);
+    sbuf.WriteN(1000, values.data(), values.size());
+    EXPECT_EQ(sbuf[1023], 7);
+    EXPECT_EQ(sbuf[75], 7);
+    std::vector<int> out(values.size());
+    sbuf.ReadN(1024 + 1000, out.data(), out.size());
+    EXPECT_EQ(out, values);
+}
+
+// Wait strategies are pluggable: spin, but give the CPU away (the tests may run on one core)
+struct YieldWait
+{
+    static constexpr size_t SPINS = SIZE_MAX;
+    static constexpr bool PARKS = false;
+    static void Pause() { std::this_thread::yield(); }
+};
+
+template <typename W>
+void BlockingProducerConsumer()
+{
+    const uint64_t n = 100000;
+    CSpscByteBuffer qbuf;
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < n; ++i) qbuf.Push<W>(i);
+    });
+    for (uint64_t i = 0; i < n; ++i) {
+        ASSERT_EQ((qbuf.Pop<uint64_t, W>()), i);
+    }
+    producer.join();
+    EXPECT_TRUE(qbuf.IsEmpty());
+    EXPECT_EQ(qbuf.ConsumerParked.load(), 0u);
+    EXPECT_EQ(qbuf.ProducerParked.load(), 0u);
+}
+
+TEST(CSpscByteBufferTest, WaitStrategies) {
+    BlockingProducerConsumer<YieldWait>();
+    BlockingProducerConsumer<SpinFutexWait>();
+    BlockingProducerConsumer<FutexWait>();
+}
+
+TEST(CSpscByteBufferTest, ParkedConsumerWakes) {
+    CSpscByteBuffer qbuf;
+    uint64_t v = 0;
+    std::thread consumer([&]() { v = qbuf.Pop<uint64_t, FutexWait>(); });
+
+    // the consumer parks on Head, and the push wakes it
+    while (qbuf.ConsumerParked.load() == 0) std::this_thread::yield();
+    qbuf.Push<FutexWait>(uint64_t(42));
+    consumer.join();
+    EXPECT_EQ(v, 42u);
+
+    // a full buffer parks the producer, until the consumer pops
+    const size_t count = qbuf.PSize / sizeof(uint64_t);
+    for (uint64_t i = 0; i < count; ++i) qbuf.Push<FutexWait>(i);
+    std::thread producer([&]() { qbuf.Push<FutexWait>(uint64_t(7)); });
+    while (qbuf.ProducerParked.load() == 0) std::this_thread::yield();
+    EXPECT_EQ((qbuf.Pop<uint64_t, FutexWait>()), 0u);
+    producer.join();
+    EXPECT_TRUE(qbuf.IsFull());
+
+    // a spinning producer still wakes a parked consumer
+    qbuf.Reset();
+    std::thread parked([&]() { v = qbuf.Pop<uint64_t, FutexWait>(); });
+    while (qbuf.ConsumerParked.load() == 0) std::this_thread::yield();
+    qbuf.Push<SpinWait>(uint64_t(43));
+    parked.join();
+    EXPECT_EQ(v, 43u);
+}
+
+TEST(CBufferTest, WindowReductions) {
+    CBuffer<float> fbuf(4096 * 2);
+    CBuffer<int32_t> ibuf(4096);
+    const size_t fcount = fbuf.GetPItemCount(), icount = ibuf.GetPItemCount();
+    for (size_t i = 0; i < fcount; ++i) fbuf[i] = static_cast<float>(i % 17) - 8.0f;
+    for (size_t i = 0; i < icount; ++i) ibuf[i] = static_cast<int32_t>(i * 7919 % 1000) - 500;
+    std::vector<float> weights(fcount, 0.5f);
+
+    // windows across the end of the physical buffer, every length around the vector widths
+    for (size_t n = 1; n < 200; n += 7)
+    {
+        size_t tail = fcount - n / 2;
+        float sum = 0, dot = 0, lo = fbuf[tail], hi = fbuf[tail];
+        for (size_t i = 0; i < n; ++i)
+        {
+            float x = fbuf[(tail + i) % fcount];
+            sum += x; dot += x * 0.5f;
+            lo = std::min(lo, x); hi = std::max(hi, x);
+        }
+        EXPECT_FLOAT_EQ(WindowSum(fbuf, tail, n), sum);
+        EXPECT_FLOAT_EQ(WindowDot(fbuf, tail, weights.data(), n), dot);
+        EXPECT_EQ(WindowMin(fbuf, tail, n), lo);
+        EXPECT_EQ(WindowMax(fbuf, tail, n), hi);
+
+        // a running count works as the tail too
+        size_t itail = 5 * icount + icount - n;
+        int32_t isum = 0, ilo = ibuf[itail % icount], ihi = ilo;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int32_t x = ibuf[(itail + i) % icount];
+            isum += x; ilo = std::min(ilo, x); ihi = std::max(ihi, x);
+        }
+        EXPECT_EQ(WindowSum(ibuf, itail, n), isum);
+        EXPECT_EQ(WindowMin(ibuf, itail, n), ilo);
+        EXPECT_EQ(WindowMax(ibuf, itail, n), ihi);
+    }
+    EXPECT_EQ(WindowSum(fbuf, 0, 0), 0.0f);
+}
+
+TEST(CRollingWindowTest, RunningSum) {
+    CRollingWindow<double> window(1000);
+    CRollingWindow<int64_t> iwindow(100);
+    EXPECT_EQ(window.GetSize(), 0u);
+    EXPECT_EQ(window.Mean(), 0.0);
+
+    // many laps of the buffer, sums stay exact (resynced) and windows contiguous
+    for (int64_t i = 0; i < 20000; ++i)
+    {
+        window.Push(static_cast<double>(i % 101) * 0.1);
+        iwindow.Push(i);
+    }
+    EXPECT_EQ(window.GetSize(), 1000u);
+    std::span<const double> samples = window.Window();
+    ASSERT_EQ(samples.size(), 1000u);
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        EXPECT_EQ(samples[i], static_cast<double>((19000 + i) % 101) * 0.1);
+        sum += samples[i];
+    }
+    EXPECT_NEAR(window.Sum(), sum, 1e-9);
+    EXPECT_NEAR(window.Mean(), sum / 1000, 1e-12);
+    EXPECT_EQ(window.Min(), 0.0);
+    EXPECT_EQ(window.Max(), 10.0);
+
+    EXPECT_EQ(iwindow.Sum(), (19900 + 19999) * 100 / 2);
+    EXPECT_EQ(iwindow.Min(), 19900);
+    EXPECT_EQ(iwindow.Max(), 19999);
+    std::vector<int64_t> ones(100, 1);
+    EXPECT_EQ(iwindow.Dot(ones.data()), iwindow.Sum());
+
+    // a window filling whole pages: the evicted sample shares the new one's slot
+    const size_t page_items = sysconf(_SC_PAGESIZE) / sizeof(int32_t);
+    CRollingWindow<int32_t> pwindow(page_items);
+    ASSERT_EQ(pwindow.Buffer.GetPItemCount(), page_items);
+    for (int32_t i = 0; i < 5000; ++i) pwindow.Push(i);
+    int64_t first = 5000 - page_items;
+    EXPECT_EQ(pwindow.Sum(), (first + 4999) * (int64_t)page_items / 2);
+    EXPECT_EQ(pwindow.Sum(), WindowSum(pwindow.Buffer, first, page_items));
+}
+
+TEST(CSpscQueueTest, RangesAndSpans) {
+    CSpscQueue<uint64_t> queue(512);
+    const size_t capacity = queue.Capacity;
+    ASSERT_EQ(capacity, 512u);
+
+    // push in uneven ranges, drain in uneven spans: many laps, spans across the end
+    std::vector<uint64_t> src(100);
+    uint64_t pushed = 0, popped = 0;
+    for (int round = 0; round < 200; ++round)
+    {
+        for (size_t i = 0; i < src.size(); ++i) src[i] = pushed + i;
+        pushed += queue.PushRange(src.begin(), src.begin() + 1 + round % 100);
+        EXPECT_TRUE(queue.TryEmplace(pushed));
+        ++pushed;
+
+        std::span<uint64_t> in = queue.FrontSpan(60 + round % 50);
+        ASSERT_FALSE(in.empty());
+        for (size_t i = 0; i < in.size(); ++i) ASSERT_EQ(in[i], popped + i);
+        popped += in.size();
+        queue.Pop(in.size());
+    }
+    EXPECT_EQ(queue.GetSize(), pushed - popped);
+
+    // partial range when nearly full, from a non contiguous range too
+    std::list<uint64_t> more(capacity, 7);
+    EXPECT_EQ(queue.PushRange(more), capacity - (pushed - popped));
+    EXPECT_FALSE(queue.TryPush(1));
+    EXPECT_EQ(queue.FrontSpan(capacity * 2).size(), capacity);
+    uint64_t v;
+    EXPECT_TRUE(queue.TryPop(v));
+    EXPECT_EQ(v, pushed > popped ? popped : 7u);
+}
+
+TEST(CMpscQueueTest, ProducersConsumer) {
+    CMpscQueue<uint64_t> queue(512);
+    const int producers = 4;
+    const uint64_t per_producer = 20000;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            std::vector<uint64_t> batch(8);
+            uint64_t i = 0;
+            while (i < per_producer)
+            {
+                // ranges and single emplaces, producer id in the high bits
+                if (i % 3 == 0)
+                {
+                    size_t n = std::min<uint64_t>(batch.size(), per_producer - i);
+                    for (size_t k = 0; k < n; ++k) batch[k] = uint64_t(p) << 32 | (i + k);
+                    size_t done = queue.PushRange(batch.begin(), batch.begin() + n);
+                    i += done;
+                    if (done == 0) std::this_thread::yield();
+                }
+                else if (queue.TryEmplace(uint64_t(p) << 32 | i)) ++i;
+                else std::this_thread::yield();
+            }
+        });
+    }
+
+    // every producer's items come out in order
+    std::vector<uint64_t> next(producers, 0);
+    uint64_t total = 0;
+    while (total < producers * per_producer)
+    {
+        std::span<uint64_t> in = queue.FrontSpan(64);
+        if (in.empty()) { std::this_thread::yield(); continue; }
+        for (uint64_t v : in)
+        {
+            int p = static_cast<int>(v >> 32);
+            ASSERT_EQ(v & 0xffffffff, next[p]);
+            ++next[p];
+        }
+        total += in.size();
+        queue.Pop(in.size());
+    }
+    for (auto &t : threads) t.join();
+    EXPECT_EQ(queue.GetSize(), 0u);
+    EXPECT_TRUE(queue.FrontSpan(1).empty());
+}
+
+struct Odd24
+{
+    uint64_t seq;
+    uint64_t check;
+    uint32_t a, b;
+};
+
+TEST(CByteBufferTest, RebasedWraparound) {
+    // record sizes that do not divide PSize, far past the virtual buffer:
+    // indices rebase, records never split, nothing gets corrupted
+    for (uint8_t views : {1, 2, 5, 16})
+    {
+        CByteBuffer cbuf(4096, views);
+        ASSERT_GE(cbuf.GetPageCount(), 2u);
+        EXPECT_EQ(cbuf.WrapSize, cbuf.VSize - cbuf.PSize);
+
+        uint64_t pushed = 0, popped = 0;
+        const uint64_t records = 40 * cbuf.VSize / sizeof(Odd24);
+        while (popped < records)
+        {
+            for (int i = 0; i < 100 && pushed < records; ++i, ++pushed)
+            {
+                cbuf.Push(Odd24{pushed, ~pushed, uint32_t(pushed), uint32_t(pushed >> 3)});
+                ASSERT_LT(cbuf.Head, cbuf.WrapSize);
+            }
+            while (popped < pushed)
+            {
+                Odd24 r = cbuf.Pop<Odd24>();
+                ASSERT_EQ(r.seq, popped);
+                ASSERT_EQ(r.check, ~popped);
+                ASSERT_LT(cbuf.Tail, cbuf.WrapSize);
+                ++popped;
+            }
+        }
+
+        // a Reserve right under WrapSize is still whole
+        cbuf.Head = cbuf.Tail = cbuf.WrapSize - 1;
+        std::span<std::byte> out = cbuf.Reserve(cbuf.PSize);
+        std::memset(out.data(), 0x5a, out.size());
+        cbuf.Commit(out.size());
+        EXPECT_EQ(cbuf.Head, cbuf.PSize - 1);
+        EXPECT_EQ(cbuf.Peek(cbuf.PSize)[cbuf.PSize - 1], std::byte(0x5a));
+    }
+}
+
+// Pushes `n` uint32_t counting from `from`, pops and checks them
+static void PushCount(CByteBuffer &cbuf, uint32_t from, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; ++i) cbuf.Push(from + i);
+}
+
+static void PopCount(CByteBuffer &cbuf, uint32_t from, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; ++i) ASSERT_EQ(cbuf.Pop<uint32_t>(), from + i);
+}
+
+TEST(CByteBufferTest, GrowShrinkTrim) {
+    CBufferOptions options;
+    options.Resizable = true;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const uint32_t per_page = page / sizeof(uint32_t);
+
+    for (MirrorMode mode : {MirrorMode::Virtual, MirrorMode::Double})
+    {
+        options.Mode = mode;
+        CByteBuffer cbuf(2 * page, (uint8_t)4, options);
+        ASSERT_NE(cbuf.Fd, -1);
+
+        // live bytes straddle the end of the physical buffer, a short wrapped part:
+        // it moves right after the old end
+        PushCount(cbuf, 0, per_page + per_page / 2);
+        PopCount(cbuf, 0, per_page + per_page / 4);
+        PushCount(cbuf, per_page + per_page / 2, per_page);
+        cbuf.Grow(4 * page);
+        EXPECT_EQ(cbuf.PSize, 4 * page);
+        EXPECT_EQ(cbuf.GetUsed(), (per_page + per_page / 4) * sizeof(uint32_t));
+        PopCount(cbuf, per_page + per_page / 4, per_page / 4 + per_page);
+
+        // a long wrapped part: the short part before the end moves to the new end
+        cbuf.Reset();
+        PushCount(cbuf, 0, 3 * per_page + per_page / 2);
+        PopCount(cbuf, 0, 3 * per_page + per_page / 4);
+        PushCount(cbuf, 3 * per_page + per_page / 2, 3 * per_page);
+        cbuf.Grow(16 * page);
+        EXPECT_EQ(cbuf.PSize, 16 * page);
+        ASSERT_EQ(cbuf.GetUsed(), (3 * per_page + per_page / 4) * sizeof(uint32_t));
+        PushCount(cbuf, 6 * per_page + per_page / 2, 10 * per_page); // room for the burst now
+        PopCount(cbuf, 3 * per_page + per_page / 4, per_page / 4 + 13 * per_page);
+        EXPECT_EQ(cbuf.GetUsed(), 0u);
+
+        // idle: trim releases every free page, and shrink back down
+        PushCount(cbuf, 0, per_page / 2);
+        EXPECT_GE(cbuf.Trim(), 14 * page);
+        std::vector<unsigned char> resident(cbuf.PSize / page);
+        ASSERT_EQ(mincore(cbuf.Data, cbuf.PSize, resident.data()), 0);
+        size_t pages = 0;
+        for (unsigned char r : resident) pages += r & 1;
+        EXPECT_LE(pages, 2u);
+
+        cbuf.Shrink(page);
+        EXPECT_EQ(cbuf.PSize, page);
+        EXPECT_EQ(cbuf.WrapSize, cbuf.VSize - cbuf.PSize);
+        if (mode == MirrorMode::Double)
+        {
+            EXPECT_EQ(cbuf.VSize, 2 * page);
+        }
+        PopCount(cbuf, 0, per_page / 2);
+        for (uint32_t lap = 0; lap < 20; ++lap) // laps of the small buffer
+        {
+            PushCount(cbuf, lap, per_page / 2 + 7);
+            PopCount(cbuf, lap, per_page / 2 + 7);
+        }
+    }
+
+    CByteBuffer fixed(page, (uint8_t)2);
+    EXPECT_THROW(fixed.Grow(2 * page), std::logic_error);
+    fixed.Push(uint32_t(1));
+    EXPECT_EQ(fixed.Trim(), 0u); // a single page, holding the live bytes
+}
+
+TEST(CByteBufferTest, AlignedPrefetch) {
+    // odd sized records, padded to a cache line (and to 16), across many rebases
+    CByteBuffer cbuf(4096, (uint8_t)4);
+    cbuf.PrefetchDistance = 256;
+    for (uint32_t i = 0; i < 5000; ++i)
+    {
+        cbuf.PushAligned(Sarasa{i, ~i, 1, 2, 3, true, false});
+        ASSERT_EQ(cbuf.Head % CACHE_LINE_SIZE, 0u);
+        Sarasa s = cbuf.PopAligned<Sarasa>();
+        ASSERT_EQ(s.a, i);
+        ASSERT_EQ(s.b, ~i);
+        ASSERT_TRUE(s.f);
+    }
+    EXPECT_EQ(cbuf.Head, cbuf.Tail);
+
+    cbuf.Reset();
+    for (uint32_t i = 0; i < 20000; ++i)
+    {
+        cbuf.PushAligned<16>(Sarasa{i, i, 0, 0, 0, false, true});
+        cbuf.Push(uint64_t(i)); // 8 byte pushes keep Head on 16 in pairs
+        cbuf.Push(uint64_t(i));
+        ASSERT_EQ((cbuf.PopAligned<Sarasa, 16>().a), i);
+        ASSERT_EQ(cbuf.Pop<uint64_t>(), i);
+        ASSERT_EQ(cbuf.Pop<uint64_t>(), i);
+    }
+}
+
+TEST(CColumnBufferTest, ColumnsShareHeadTail) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    struct Triple { uint32_t a, b, c; }; // 12 bytes: page_size / 4 rows per whole page
+
+    // timestamp, price, qty, flags: a byte column needs page_size rows
+    CColumnBuffer<uint64_t, double, uint32_t, uint8_t> ticks(1000);
+    EXPECT_EQ(ticks.GetCapacity(), page_size);
+    CColumnBuffer<uint64_t, Triple> triples(1000);
+    EXPECT_EQ(triples.GetCapacity(), page_size / 4 > 1000 ? page_size / 4 : 2 * page_size / 4);
+
+    const size_t capacity = ticks.GetCapacity();
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        ASSERT_TRUE(ticks.TryPush(i, i * 0.5, static_cast<uint32_t>(i), static_cast<uint8_t>(i)));
+    }
+    EXPECT_TRUE(ticks.IsFull());
+    EXPECT_FALSE(ticks.TryPush(0, 0.0, 0, 0));
+
+    // many laps of uneven pops and bulk pushes, columns stay contiguous and in step
+    std::vector<uint64_t> stamps(300);
+    std::vector<double> prices(300);
+    std::vector<uint32_t> qtys(300);
+    std::vector<uint8_t> flags(300);
+    uint64_t next = capacity, oldest = 0;
+    for (int lap = 0; lap < 200; ++lap)
+    {
+        size_t n = 1 + (lap * 37) % 300;
+        ticks.Pop(n);
+        oldest += n;
+        for (size_t i = 0; i < n; ++i, ++next)
+        {
+            stamps[i] = next;
+            prices[i] = next * 0.5;
+            qtys[i] = static_cast<uint32_t>(next);
+            flags[i] = static_cast<uint8_t>(next);
+        }
+        ASSERT_TRUE(ticks.TryPushN(n, stamps.data(), prices.data(), qtys.data(), flags.data()));
+        ASSERT_LT(ticks.Tail, capacity);
+
+        std::span<const uint64_t> column = ticks.Column<0>();
+        ASSERT_EQ(column.size(), capacity);
+        EXPECT_EQ(column.front(), oldest);
+        EXPECT_EQ(column.back(), next - 1);
+        EXPECT_EQ(ticks.Column<1>()[capacity / 2], (oldest + capacity / 2) * 0.5);
+        EXPECT_EQ(ticks.Column<3>().back(), static_cast<uint8_t>(next - 1));
+    }
+    EXPECT_FALSE(ticks.TryPushN(1, stamps.data(), prices.data(), qtys.data(), flags.data()));
+
+    // a column scan is a plain window reduction
+    std::span<const uint32_t> column = ticks.Column<2>();
+    uint64_t sum = 0;
+    for (uint32_t qty : column) sum += qty;
+    EXPECT_EQ(WindowSum(ticks.GetBuffer<2>(), ticks.Tail, ticks.GetSize()), static_cast<uint32_t>(sum));
+
+    auto [stamp, price, qty, flag] = ticks.GetRow(1);
+    EXPECT_EQ(stamp, oldest + 1);
+    EXPECT_EQ(price, (oldest + 1) * 0.5);
+    EXPECT_EQ(qty, static_cast<uint32_t>(oldest + 1));
+    EXPECT_EQ(flag, static_cast<uint8_t>(oldest + 1));
+
+    ticks.Pop(ticks.GetSize());
+    EXPECT_TRUE(ticks.IsEmpty());
+    EXPECT_EQ(ticks.Column<0>().size(), 0u);
+}
+
+TEST(CJournalByteBufferTest, FlushAndRecover) {
+    char path[] = "/tmp/cjournal_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd); // empty: Open() creates the journal
+
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t pushed = 0, popped = 0;
+    {
+        CJournalByteBuffer journal = CJournalByteBuffer::Open(path, page_size);
+        EXPECT_EQ(journal.PSize, page_size);
+        EXPECT_TRUE(journal.IsEmpty());
+
+        // a few laps of the file, 24 byte records straddling its end
+        for (int lap = 0; lap < 10; ++lap)
+        {
+            while (journal.TryPush(Odd24{pushed, ~pushed, static_cast<uint32_t>(pushed * 3), 0})) ++pushed;
+            Odd24 r;
+            for (int i = 0; i < 100; ++i, ++popped)
+            {
+                ASSERT_TRUE(journal.TryPop(r));
+                ASSERT_EQ(r.seq, popped);
+                ASSERT_EQ(r.a, static_cast<uint32_t>(popped * 3));
+            }
+        }
+        journal.Flush();
+        EXPECT_EQ(journal.GetUnflushed(), 0u);
+
+        // lost in the "crash": pops and pushes after the last flush
+        Odd24 r;
+        ASSERT_TRUE(journal.TryPop(r));
+        ASSERT_TRUE(journal.TryPush(Odd24{999999, 0, 0, 0}));
+        EXPECT_EQ(journal.GetUnflushed(), sizeof(Odd24));
+    }
+
+    {
+        // a different size is ignored: the journal keeps its own
+        CJournalByteBuffer journal = CJournalByteBuffer::Open(path, 16 * page_size, true);
+        EXPECT_EQ(journal.PSize, page_size);
+        EXPECT_EQ(journal.GetUsed(), (pushed - popped) * sizeof(Odd24));
+        Odd24 r;
+        uint64_t replayed = popped;
+        while (journal.TryPop(r))
+        {
+            ASSERT_EQ(r.seq, replayed);
+            ASSERT_EQ(r.check, ~replayed);
+            ++replayed;
+        }
+        EXPECT_EQ(replayed, pushed);
+
+        // in place, flushing one record on its own first
+        std::span<std::byte> out = journal.Reserve(sizeof(Odd24));
+        ASSERT_EQ(out.size(), sizeof(Odd24));
+        Odd24 last{pushed, ~pushed, 0, 0};
+        std::memcpy(out.data(), &last, sizeof(last));
+        journal.Flush(out);
+        journal.Commit(sizeof(Odd24));
+        journal.Flush();
+    }
+
+    {
+        CJournalByteBuffer journal = CJournalByteBuffer::Open(path, page_size);
+        Odd24 r;
+        ASSERT_TRUE(journal.TryPop(r));
+        EXPECT_EQ(r.seq, pushed);
+        EXPECT_TRUE(journal.IsEmpty());
+    }
+
+    {
+        // consumed, not flushed, then overwritten: the header must not
+        // replay the new bytes as the old records
+        ASSERT_EQ(truncate(path, 0), 0);
+        CJournalByteBuffer journal = CJournalByteBuffer::Open(path, page_size);
+        std::span<std::byte> out = journal.Reserve(page_size);
+        ASSERT_EQ(out.size(), page_size);
+        std::memset(out.data(), 'A', page_size);
+        journal.Commit(page_size);
+        journal.Flush();
+        ASSERT_EQ(journal.Peek(page_size).size(), page_size);
+        journal.Consume(page_size);
+        out = journal.Reserve(page_size);
+        ASSERT_EQ(out.size(), page_size);
+        std::memset(out.data(), 'B', page_size);
+        journal.Commit(page_size);
+    }
+
+    {
+        // the 'A' records were consumed for good, the 'B' ones never flushed
+        CJournalByteBuffer journal = CJournalByteBuffer::Open(path, page_size);
+        EXPECT_TRUE(journal.IsEmpty());
+        EXPECT_EQ(journal.Head, page_size);
+    }
+
+    // not a journal
+    fd = open(path, O_RDWR | O_TRUNC);
+    ASSERT_NE(fd, -1);
+    std::vector<char> junk(3 * page_size, 'x');
+    ASSERT_EQ(write(fd, junk.data(), junk.size()), (ssize_t)junk.size());
+    close(fd);
+    EXPECT_THROW(CJournalByteBuffer::Open(path, page_size), std::invalid_argument);
+    unlink(path);
+}
+
+TEST(CBroadcastByteBufferTest, EveryReaderSeesEverything) {
+    const int readers = 4;
+    const uint64_t items = 200000;
+    CBroadcastByteBuffer ring(4096, readers);
+    EXPECT_THROW(CBroadcastByteBuffer(4096, 0), std::invalid_argument);
+
+    std::vector<uint64_t> sums(readers, 0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r)
+    {
+        threads.emplace_back([&, r]() {
+            uint64_t expected = 0, item;
+            while (expected < items)
+            {
+                if (!ring.TryPop(r, item)) { std::this_thread::yield(); continue; }
+                ASSERT_EQ(item, expected);
+                sums[r] += item;
+                ++expected;
+            }
+        });
+    }
+    for (uint64_t i = 0; i < items; ++i)
+    {
+        while (!ring.TryPush(i)) std::this_thread::yield();
+    }
+    for (auto &t : threads) t.join();
+    for (int r = 0; r < readers; ++r)
+    {
+        EXPECT_EQ(sums[r], items * (items - 1) / 2);
+        EXPECT_EQ(ring.GetPoppable(r), 0u);
+    }
+}
+
+TEST(CBroadcastByteBufferTest, SlowestReaderBoundsOrLapped) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t capacity = page_size / sizeof(uint64_t);
+
+    // not lossy: an idle reader holds the producer up
+    CBroadcastByteBuffer ring(page_size, 2);
+    uint64_t item = 0;
+    for (; item < capacity; ++item) ASSERT_TRUE(ring.TryPush(item));
+    for (uint64_t i = 0; i < capacity; ++i) ASSERT_TRUE(ring.TryPop(0, item));
+    EXPECT_FALSE(ring.TryPush(item));
+    ASSERT_TRUE(ring.TryPop(1, item));
+    EXPECT_EQ(item, 0u);
+    EXPECT_TRUE(ring.TryPush(item));
+
+    // lossy: it gets lapped instead, and picks up again from Head
+    CBroadcastByteBuffer lossy(page_size, 2, true);
+    std::span<const std::byte> held;
+    for (uint64_t i = 0; i < capacity + 10; ++i)
+    {
+        ASSERT_TRUE(lossy.TryPush(i));
+        ASSERT_TRUE(lossy.TryPop(0, item));
+        ASSERT_EQ(item, i);
+        if (i == 0) held = lossy.Peek(1, sizeof(uint64_t));
+    }
+    EXPECT_FALSE(lossy.IsLapped(0));
+    EXPECT_TRUE(lossy.IsLapped(1));
+    EXPECT_EQ(lossy.GetPoppable(1), 0u);
+    EXPECT_FALSE(lossy.TryPop(1, item));
+    EXPECT_FALSE(lossy.Consume(1, held.size())); // read while overwritten: refused
+
+    EXPECT_EQ(lossy.Resync(1), (capacity + 10) * sizeof(uint64_t)); // never read a thing
+    EXPECT_EQ(lossy.Resync(1), 0u);
+    ASSERT_TRUE(lossy.TryPush(uint64_t(12345)));
+    ASSERT_TRUE(lossy.TryPop(1, item));
+    EXPECT_EQ(item, 12345u);
+}
+
+TEST(CPipelineStageTest, ChainedStagesBackpressure) {
+    const size_t total = 300000;
+    CSpscByteBuffer source(4096), middle(4096), sink(4096);
+    std::atomic<bool> source_done(false);
+
+    // 1:1, in place from one ring to the next
+    auto scramble = [](std::span<const std::byte> in, std::span<std::byte> out) {
+        size_t n = in.size() < out.size() ? in.size() : out.size();
+        for (size_t i = 0; i < n; ++i) out[i] = in[i] ^ std::byte{0x5a};
+        return CTransformResult{n, n};
+    };
+    // 1:2, so it runs out of output room first
+    auto twice = [](std::span<const std::byte> in, std::span<std::byte> out) {
+        size_t n = in.size() < out.size() / 2 ? in.size() : out.size() / 2;
+        for (size_t i = 0; i < n; ++i) out[2*i] = out[2*i + 1] = in[i];
+        return CTransformResult{n, 2*n};
+    };
+    CPipelineStage first(source, middle, scramble);
+    CPipelineStage second(middle, sink, twice, 1000);
+
+    std::thread producer([&]() {
+        size_t pushed = 0;
+        while (pushed < total)
+        {
+            size_t n = total - pushed < 777 ? total - pushed : 777;
+            std::span<std::byte> out = source.Reserve(n);
+            if (out.empty()) { std::this_thread::yield(); continue; }
+            for (size_t i = 0; i < n; ++i) out[i] = std::byte(static_cast<uint8_t>((pushed + i) % 251));
+            source.Commit(n);
+            pushed += n;
+        }
+        source_done.store(true, std::memory_order_release);
+    });
+    std::thread stage1([&]() { first.Run(source_done); });
+    std::thread stage2([&]() { second.Run(first.Done); });
+
+    size_t received = 0;
+    bool ok = true;
+    while (!second.Done.load(std::memory_order_acquire) || !sink.IsEmpty())
+    {
+        size_t ready = sink.GetPoppable();
+        if (ready == 0) { std::this_thread::yield(); continue; }
+        std::span<const std::byte> in = sink.Peek(ready);
+        for (size_t i = 0; i < ready; ++i, ++received)
+        {
+            uint8_t expected = static_cast<uint8_t>((received / 2) % 251) ^ 0x5a;
+            ok = ok && std::to_integer<uint8_t>(in[i]) == expected;
+        }
+        sink.Consume(ready);
+    }
+    producer.join();
+    stage1.join();
+    stage2.join();
+
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(received, 2 * total);
+    EXPECT_TRUE(source.IsEmpty());
+    EXPECT_TRUE(middle.IsEmpty());
+
+    // a truncated record at the end does not hold a stage forever
+    CSpscByteBuffer in_ring(4096), out_ring(4096);
+    ASSERT_TRUE(in_ring.TryPush(uint16_t(7)));
+    std::atomic<bool> closed(true);
+    CPipelineStage words(in_ring, out_ring, [](std::span<const std::byte> in, std::span<std::byte> out) {
+        size_t n = in.size() / 4 * 4;
+        if (n > out.size()) n = out.size() / 4 * 4;
+        std::memcpy(out.data(), in.data(), n);
+        return CTransformResult{n, n};
+    });
+    words.Run(closed);
+    EXPECT_TRUE(words.Done.load());
+    EXPECT_EQ(in_ring.GetPoppable(), sizeof(uint16_t));
+    EXPECT_TRUE(out_ring.IsEmpty());
+
+    // a record refused for room, with downstream draining the output while
+    // the step runs, is not left behind
+    CSpscByteBuffer late_in(4096), late_out(4096);
+    std::vector<std::byte> record(100, std::byte{1});
+    ASSERT_TRUE(late_in.TryPushN(record.data(), record.size()));
+    std::vector<std::byte> fill(late_out.PSize - 50);
+    ASSERT_TRUE(late_out.TryPushN(fill.data(), fill.size()));
+    CPipelineStage whole(late_in, late_out, [&](std::span<const std::byte> in, std::span<std::byte> out) {
+        if (out.size() < in.size())
+        {
+            late_out.Consume(late_out.GetPoppable()); // downstream, mid step
+            return CTransformResult{0, 0};
+        }
+        std::memcpy(out.data(), in.data(), in.size());
+        return CTransformResult{in.size(), in.size()};
+    });
+    whole.Run(closed);
+    EXPECT_TRUE(late_in.IsEmpty());
+    EXPECT_EQ(late_out.GetPoppable(), record.size());
+}
+
+#if CBUFFER_STATS
+TEST(CBufferStatsTest, CountersAndSnapshot) {
+    // two views: indices wrap every PSize bytes
+    CByteBuffer cbuf(4096, 2);
+    const uint64_t records = cbuf.PSize / sizeof(uint64_t);
+    for (uint64_t i = 0; i < records; ++i) cbuf.Push(i);
+    CBufferStatsSnapshot s = cbuf.GetStats();
+    EXPECT_TRUE(s.Enabled);
+    EXPECT_EQ(s.BytesPushed, cbuf.PSize);
+    EXPECT_EQ(s.HighWater, cbuf.PSize);
+    EXPECT_EQ(s.FullStalls, 0u);
+    EXPECT_EQ(s.Wraps, 1u);
+
+    // one more overwrites the oldest record, popping past Head reads garbage
+    cbuf.Push(records);
+    for (uint64_t i = 0; i <= records; ++i) cbuf.Pop<uint64_t>();
+    cbuf.Pop<uint64_t>();
+    s = cbuf.GetStats();
+    EXPECT_EQ(s.BytesPushed, cbuf.PSize + sizeof(uint64_t));
+    EXPECT_EQ(s.BytesPopped, cbuf.PSize + 2 * sizeof(uint64_t));
+    EXPECT_EQ(s.HighWater, cbuf.PSize);
+    EXPECT_EQ(s.FullStalls, 1u);
+    EXPECT_EQ(s.EmptyStalls, 1u);
+    EXPECT_EQ(s.Wraps, 2u);
+
+    cbuf.Reset();
+    s = cbuf.GetStats();
+    EXPECT_EQ(s.BytesPushed, 0u);
+    EXPECT_EQ(s.HighWater, 0u);
+    EXPECT_EQ(s.Wraps, 0u);
+
+    // the queue counts refused tries
+    CSpscByteBuffer qbuf(4096);
+    uint64_t v;
+    EXPECT_FALSE(qbuf.TryPop(v));
+    for (uint64_t i = 0; i < records; ++i) ASSERT_TRUE(qbuf.TryPush(i));
+    EXPECT_FALSE(qbuf.TryPush(v));
+    EXPECT_TRUE(qbuf.Reserve(sizeof(uint64_t)).empty());
+    ASSERT_TRUE(qbuf.TryPopN(std::vector<uint64_t>(records).data(), records));
+    s = qbuf.GetStats();
+    EXPECT_EQ(s.BytesPushed, qbuf.PSize);
+    EXPECT_EQ(s.BytesPopped, qbuf.PSize);
+    EXPECT_EQ(s.HighWater, qbuf.PSize);
+    EXPECT_EQ(s.FullStalls, 2u);
+    EXPECT_EQ(s.EmptyStalls, 1u);
+    EXPECT_EQ(s.Wraps, 2u);
+}
+#else
+TEST(CBufferStatsTest, CompiledOut) {
+    static_assert(std::is_empty_v<CNoBufferStats>);
+    CByteBuffer cbuf(4096, 2);
+    cbuf.Push(uint64_t(1));
+    CBufferStatsSnapshot s = cbuf.GetStats();
+    EXPECT_FALSE(s.Enabled);
+    EXPECT_EQ(s.BytesPushed, 0u);
+}
+#endif
@@ -0,0 +1,178 @@
+#ifndef C_COLUMN_HPP
+#define C_COLUMN_HPP
+
+#include <tuple>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <utility>
+
+#include "cbuffer.hpp"
+
+// Ring of rows stored as columns (structure of arrays): one mirrored
+// CBuffer<Ts> per field, sharing a single Head and Tail. A push scatters the
+// row across the columns, and each column is a contiguous span over the live
+// rows, so scanning one field is a unit stride loop (or a WindowSum) that
+// never touches the others.
+//
+// Every column holds the same number of rows, so the capacity is the least
+// row count that fills whole pages in every column: a multiple of
+// PageSize / gcd(PageSize, sizeof(T)) for each of them. Single threaded, like
+// CByteBuffer.
+template <typename... Ts>
+class CColumnBuffer
+{
+    static_assert(sizeof...(Ts) > 0, "CColumnBuffer needs at least one column.");
+    static_assert((std::is_trivially_copyable_v<Ts> && ...), "CColumnBuffer requires trivially copyable columns.");
+
+public:
+    template <size_t I>
+    using ColumnType = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+    std::tuple<std::unique_ptr<CBuffer<Ts>>...> Columns; // One buffer per field, mirrored twice
+    size_t Count;  // Rows that fit, in every column
+    uint64_t Head; // Next push, rows (Tail + rows in the ring)
+    uint64_t Tail; // Next pop, rows, always below Count
+
+    // Room for at least `count_` rows, rounded up to whole pages in every
+    // column (and to huge pages if `options_` asks for them).
+    CColumnBuffer(size_t count_,
+                  const CBufferOptions &options_ = CBufferOptions()) : Count(ToRowCount(count_, options_)),
+                                                                       Head(0),
+                                                                       Tail(0)
+    {
+        Columns = std::make_tuple(std::make_unique<CBuffer<Ts>>(Count * sizeof(Ts), 2, options_)...);
+
+        bool same = std::apply([this](const auto &...column) {
+            return ((column->GetPItemCount() == Count && column->GetPageCount() >= 2) && ...);
+        }, Columns);
+        if (!same)
+        {
+            // a column fell back to regular pages while another got huge ones
+            throw std::logic_error("CColumnBuffer: columns ended up with different row counts");
+        }
+    };
+
+    CColumnBuffer(const CColumnBuffer &) = delete;
+    CColumnBuffer &operator=(const CColumnBuffer &) = delete;
+
+    void Reset()
+    {
+        Head = 0;
+        Tail = 0;
+    };
+
+    size_t GetCapacity() const
+    {
+        return Count;
+    };
+
+    // Rows in the ring
+    size_t GetSize() const
+    {
+        return Head - Tail;
+    };
+
+    bool IsEmpty() const
+    {
+        return Head == Tail;
+    };
+
+    bool IsFull() const
+    {
+        return Head - Tail == Count;
+    };
+
+    // The buffer behind column `I`, for the cwindow.hpp reductions:
+    // WindowSum(ring.GetBuffer<I>(), ring.Tail, ring.GetSize())
+    template <size_t I>
+    CBuffer<ColumnType<I>> &GetBuffer()
+    {
+        return *std::get<I>(Columns);
+    };
+
+    template <size_t I>
+    const CBuffer<ColumnType<I>> &GetBuffer() const
+    {
+        return *std::get<I>(Columns);
+    };
+
+    // Column `I` of the rows in the ring, oldest first. No wraparound: the
+    // mirror makes up to Count rows from any Tail contiguous.
+    template <size_t I>
+    std::span<ColumnType<I>> Column()
+    {
+        return std::span<ColumnType<I>>(&GetBuffer<I>().Data[Tail], GetSize());
+    };
+
+    template <size_t I>
+    std::span<const ColumnType<I>> Column() const
+    {
+        return std::span<const ColumnType<I>>(&GetBuffer<I>().Data[Tail], GetSize());
+    };
+
+    // Scatters one row across the columns. Returns `false` if full.
+    bool TryPush(const Ts &...fields)
+    {
+        if (IsFull()) return false;
+        Store(std::index_sequence_for<Ts...>(), fields...);
+        ++Head;
+        return true;
+    };
+
+    // Appends `n` rows given column by column, one BulkCopy per column.
+    // All `n` rows or none: returns `false` if they do not fit.
+    bool TryPushN(size_t n, const Ts *...columns)
+    {
+        if (n > Count - GetSize()) return false;
+        StoreN(std::index_sequence_for<Ts...>(), n, columns...);
+        Head += n;
+        return true;
+    };
+
+    // Row `i` of the ring, 0 being the oldest, gathered from the columns
+    std::tuple<Ts...> GetRow(size_t i) const
+    {
+        assert(i < GetSize());
+        return std::apply([this, i](const auto &...column) {
+            return std::tuple<Ts...>(column->Data[Tail + i]...);
+        }, Columns);
+    };
+
+    // Releases the oldest `n` rows, `n` at most GetSize()
+    void Pop(size_t n = 1)
+    {
+        assert(n <= GetSize());
+        Tail += n;
+        if (Tail >= Count)
+        {
+            Tail -= Count;
+            Head -= Count;
+        }
+    };
+
+private:
+    // Least row count, at least `count`, that is a whole number of pages in
+    // every column
+    static size_t ToRowCount(size_t count, const CBufferOptions &options)
+    {
+        size_t page = options.HugePageSize ? options.HugePageSize : sysconf(_SC_PAGESIZE);
+        size_t unit = 1;
+        ((unit = std::lcm(unit, page / std::gcd(page, sizeof(Ts)))), ...);
+        return count <= unit ? unit : (count + unit - 1) / unit * unit;
+    };
+
+    template <size_t... I>
+    void Store(std::index_sequence<I...>, const Ts &...fields)
+    {
+        ((std::get<I>(Columns)->Data[Head] = fields), ...);
+    };
+
+    template <size_t... I>
+    void StoreN(std::index_sequence<I...>, size_t n, const Ts *...columns)
+    {
+        (std::get<I>(Columns)->WriteN(Head, columns, n), ...);
+    };
+};
+
+#endif
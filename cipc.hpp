@@ -0,0 +1,313 @@
+#ifndef C_IPC_HPP
+#define C_IPC_HPP
+
+#include <atomic>
+#include <span>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "cbuffer.hpp"
+
+// Control page at the start of the shared memory, Head and Tail live here so
+// every process attached to the ring sees the same ones.
+struct CIpcHeader
+{
+    static constexpr uint64_t MAGIC = 0x3170694366667562; // "bufCipc1"
+
+    std::atomic<uint64_t> Magic; // Set last by Create(), once the header is valid
+    uint64_t PSize;              // Physical buffer size
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Bytes pushed: next push
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Tail; // Bytes popped: next pop
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "CIpcByteBuffer needs address free (lock free) 64 bit atomics.");
+
+// Single-producer/single-consumer byte ring shared between processes: one
+// process pushes, another one pops, zero copy with Reserve/Commit and Peek/Consume.
+//
+// The shared memory is a memfd (attach through its fd: inherited, or sent
+// over a Unix socket) or a named POSIX shm object (attach by name). It holds
+// one header page (CIpcHeader) and then the physical buffer. Every process maps
+// the buffer twice with its own views, like CSpscByteBuffer, so records of up to
+// PSize bytes are contiguous. Cached indices and offsets are per process.
+//
+// PSize: Physical buffer size, also the capacity in bytes.
+// VSize: Virtual buffer size, 2x PSize.
+class CIpcByteBuffer
+{
+public:
+    size_t PSize;        // Physical buffer size (multiple of your page size, probably 4096)
+    size_t VSize;        // Virtual buffer size, 2x PSize
+    size_t PageSize;     // Page size backing the buffer
+    std::byte *Data;     // Buffer
+    CIpcHeader *Header;  // Shared Head and Tail
+    int Fd;              // Shared memory, open for as long as the buffer lives
+
+    // New ring of at least `size` bytes. Named shm object if `name` is set
+    // (must start with '/', fails if it exists), anonymous memfd otherwise.
+    static CIpcByteBuffer Create(size_t size, const char *name = nullptr)
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t psize = ToNextPageSize(size, page_size);
+        int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)
+                      : memfd_create("CIpcByteBuffer", 0);
+        if (fd == -1)
+        {
+            throw std::runtime_error(name ? "shm_open failed" : "memfd_create failed");
+        }
+        if (ftruncate(fd, page_size + psize) == -1)
+        {
+            close(fd);
+            if (name) shm_unlink(name);
+            throw std::runtime_error("ftruncate failed");
+        }
+
+        try
+        {
+            CIpcByteBuffer buffer(fd, psize, name);
+            buffer.Header->PSize = psize;
+            buffer.Header->Head.store(0, std::memory_order_relaxed);
+            buffer.Header->Tail.store(0, std::memory_order_relaxed);
+            buffer.Header->Magic.store(CIpcHeader::MAGIC, std::memory_order_release);
+            return buffer;
+        }
+        catch (...)
+        {
+            if (name) shm_unlink(name);
+            throw;
+        }
+    };
+
+    // Maps the ring behind `fd_` (from Create(), see Fd). `fd_` is duplicated,
+    // the caller keeps its own.
+    static CIpcByteBuffer Attach(int fd_)
+    {
+        int fd = dup(fd_);
+        if (fd == -1)
+        {
+            throw std::runtime_error("dup failed");
+        }
+        return CIpcByteBuffer(fd, SharedSize(fd), nullptr);
+    };
+
+    // Maps the ring of the named shm object `name_`, from Create()
+    static CIpcByteBuffer Attach(const char *name_)
+    {
+        int fd = shm_open(name_, O_RDWR, 0);
+        if (fd == -1)
+        {
+            throw std::runtime_error("shm_open failed");
+        }
+        return CIpcByteBuffer(fd, SharedSize(fd), nullptr);
+    };
+
+    CIpcByteBuffer(CIpcByteBuffer &&other) : PSize(other.PSize),
+                                             VSize(other.VSize),
+                                             PageSize(other.PageSize),
+                                             Data(other.Data),
+                                             Header(other.Header),
+                                             Fd(other.Fd),
+                                             CachedTail(other.CachedTail),
+                                             HeadOffset(other.HeadOffset),
+                                             CachedHead(other.CachedHead),
+                                             TailOffset(other.TailOffset),
+                                             Name(other.Name)
+    {
+        other.Data = nullptr;
+        other.Header = nullptr;
+        other.Fd = -1;
+        other.Name = nullptr;
+    };
+
+    // The creator of a named ring also removes the name
+    ~CIpcByteBuffer()
+    {
+        if (Data != nullptr && munmap(Data, VSize) == -1)
+        {
+            fprintf(stderr, "CIpcByteBuffer Cleanup Error: %s\n", strerror(errno));
+        }
+        if (Header != nullptr && munmap(Header, PageSize) == -1)
+        {
+            fprintf(stderr, "CIpcByteBuffer Cleanup Error: %s\n", strerror(errno));
+        }
+        if (Fd != -1) close(Fd);
+        if (Name != nullptr)
+        {
+            shm_unlink(Name);
+            free(Name);
+        }
+    };
+
+    CIpcByteBuffer(const CIpcByteBuffer &) = delete;
+    CIpcByteBuffer &operator=(const CIpcByteBuffer &) = delete;
+
+    // Free bytes. Exact when called by the producer.
+    size_t GetPushable() const
+    {
+        return PSize - (Header->Head.load(std::memory_order_relaxed) - Header->Tail.load(std::memory_order_acquire));
+    };
+
+    // Bytes ready to pop. Exact when called by the consumer.
+    size_t GetPoppable() const
+    {
+        return Header->Head.load(std::memory_order_acquire) - Header->Tail.load(std::memory_order_relaxed);
+    };
+
+    bool IsEmpty() const
+    {
+        return Header->Head.load(std::memory_order_acquire) == Header->Tail.load(std::memory_order_acquire);
+    };
+
+    // Producer only. Contiguous `n` free bytes at head, to be written in place
+    // and published with Commit(). Empty if `n` bytes are not free.
+    std::span<std::byte> Reserve(size_t n)
+    {
+        uint64_t head = Header->Head.load(std::memory_order_relaxed);
+        if (PSize - (head - CachedTail) < n)
+        {
+            CachedTail = Header->Tail.load(std::memory_order_acquire);
+            if (PSize - (head - CachedTail) < n)
+            {
+                return std::span<std::byte>();
+            }
+        }
+        return std::span<std::byte>(&Data[HeadOffset], n);
+    };
+
+    // Producer only. Publishes `n` bytes written through Reserve()
+    void Commit(size_t n)
+    {
+        uint64_t head = Header->Head.load(std::memory_order_relaxed);
+        HeadOffset += n;
+        if (HeadOffset >= PSize) HeadOffset -= PSize;
+        Header->Head.store(head + n, std::memory_order_release);
+    };
+
+    // Consumer only. Contiguous `n` ready bytes at tail, to be read in place
+    // and released with Consume(). Empty if `n` bytes are not ready.
+    std::span<const std::byte> Peek(size_t n)
+    {
+        uint64_t tail = Header->Tail.load(std::memory_order_relaxed);
+        if (CachedHead - tail < n)
+        {
+            CachedHead = Header->Head.load(std::memory_order_acquire);
+            if (CachedHead - tail < n)
+            {
+                return std::span<const std::byte>();
+            }
+        }
+        return std::span<const std::byte>(&Data[TailOffset], n);
+    };
+
+    // Consumer only. Releases `n` bytes read through Peek()
+    void Consume(size_t n)
+    {
+        uint64_t tail = Header->Tail.load(std::memory_order_relaxed);
+        TailOffset += n;
+        if (TailOffset >= PSize) TailOffset -= PSize;
+        Header->Tail.store(tail + n, std::memory_order_release);
+    };
+
+    // Producer only. Returns false (and pushes nothing) if `data` does not fit.
+    template <typename T>
+    bool TryPush(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::span<std::byte> out = Reserve(sizeof(T));
+        if (out.empty()) return false;
+        std::memcpy(out.data(), &data, sizeof(T));
+        Commit(sizeof(T));
+        return true;
+    };
+
+    // Consumer only. Returns false (and leaves `data` untouched) if there is
+    // no complete T to pop.
+    template <typename T>
+    bool TryPop(T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::span<const std::byte> in = Peek(sizeof(T));
+        if (in.empty()) return false;
+        std::memcpy(&data, in.data(), sizeof(T));
+        Consume(sizeof(T));
+        return true;
+    };
+
+private:
+    uint64_t CachedTail; // Last Tail seen by this process (producer side)
+    size_t HeadOffset;   // Head % PSize
+    uint64_t CachedHead; // Last Head seen by this process (consumer side)
+    size_t TailOffset;   // Tail % PSize
+    char *Name;          // Named ring created by this process, unlinked on destruction
+
+    // Takes ownership of `fd_`, closed if mapping fails
+    CIpcByteBuffer(int fd_, size_t psize_, const char *name_) : PSize(psize_),
+                                                                VSize(2*psize_),
+                                                                PageSize(sysconf(_SC_PAGESIZE)),
+                                                                Data(nullptr),
+                                                                Header(nullptr),
+                                                                Fd(fd_),
+                                                                Name(nullptr)
+    {
+        void *header = mmap(NULL, PageSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+        if (header == MAP_FAILED)
+        {
+            close(Fd);
+            throw std::runtime_error("Header mapping failed");
+        }
+        Header = static_cast<CIpcHeader *>(header);
+
+        try
+        {
+            Data = static_cast<std::byte *>(MapMirrorFd(Fd, PageSize, PSize, VSize));
+        }
+        catch (...)
+        {
+            munmap(Header, PageSize);
+            close(Fd);
+            throw;
+        }
+
+        uint64_t head = Header->Head.load(std::memory_order_acquire);
+        uint64_t tail = Header->Tail.load(std::memory_order_acquire);
+        CachedTail = tail;
+        HeadOffset = head % PSize;
+        CachedHead = head;
+        TailOffset = tail % PSize;
+        if (name_ != nullptr) Name = strdup(name_);
+    };
+
+    // PSize of the ring behind `fd`, checked against the shared memory size.
+    // Closes `fd` if it is not a ring.
+    static size_t SharedSize(int fd)
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (size_t)st.st_size < 2*page_size)
+        {
+            close(fd);
+            throw std::invalid_argument("CIpcByteBuffer: not a shared ring");
+        }
+        void *header = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (header == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Header mapping failed");
+        }
+        const CIpcHeader *h = static_cast<const CIpcHeader *>(header);
+        bool valid = h->Magic.load(std::memory_order_acquire) == CIpcHeader::MAGIC &&
+                     h->PSize + page_size == (size_t)st.st_size;
+        size_t psize = h->PSize;
+        munmap(header, page_size);
+        if (!valid)
+        {
+            close(fd);
+            throw std::invalid_argument("CIpcByteBuffer: not a shared ring");
+        }
+        return psize;
+    };
+};
+
+#endif
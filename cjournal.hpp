@@ -0,0 +1,376 @@
+#ifndef C_JOURNAL_HPP
+#define C_JOURNAL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "cbuffer.hpp"
+
+// Header page at the start of the journal file. Head and Tail here are the
+// durable ones: what a reopen recovers.
+struct CJournalHeader
+{
+    static constexpr uint64_t MAGIC = 0x316e6a4366667562; // "buffCjn1"
+
+    std::atomic<uint64_t> Magic; // Written last by a fresh Open(), once the header is valid
+    uint64_t PSize;              // Physical buffer size
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Bytes flushed: first byte not recovered
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Tail; // Bytes consumed, as of the last Flush()
+};
+
+// Writes back the cache lines of [addr, addr + n) to memory, then fences:
+// persists a range of a MAP_SYNC mapping of a DAX (pmem) file.
+__attribute__((target("clwb")))
+inline void WriteBackLinesClwb(const void *addr, size_t n)
+{
+    uintptr_t end = (uintptr_t)addr + n;
+    for (uintptr_t line = (uintptr_t)addr & ~(uintptr_t)(CACHE_LINE_SIZE - 1); line < end; line += CACHE_LINE_SIZE)
+    {
+        _mm_clwb((void *)line);
+    }
+    _mm_sfence();
+}
+
+// Same, evicting the lines, for CPUs without clwb
+inline void WriteBackLinesClflush(const void *addr, size_t n)
+{
+    uintptr_t end = (uintptr_t)addr + n;
+    for (uintptr_t line = (uintptr_t)addr & ~(uintptr_t)(CACHE_LINE_SIZE - 1); line < end; line += CACHE_LINE_SIZE)
+    {
+        _mm_clflush((const void *)line);
+    }
+    _mm_sfence();
+}
+
+// CPU dispatch, resolved on first use
+inline void WriteBackLines(const void *addr, size_t n)
+{
+    static void (*const kernel)(const void *, size_t) = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("clwb") ? WriteBackLinesClwb : WriteBackLinesClflush;
+    }();
+    kernel(addr, n);
+}
+
+// Crash safe byte ring over a regular file: a mmap'd write-ahead journal.
+// Records go in place with Reserve/Commit (or TryPush), no stdio copy, and
+// Flush() makes everything committed durable: the bytes first, then Head and
+// Tail in the header page. A reopen recovers the ring as of the last Flush():
+// commits after it are lost, as if never made, and consumed bytes not
+// flushed are popped again (at least once delivery).
+//
+// The file holds one header page (CJournalHeader) and then the physical
+// buffer, mirrored twice like CIpcByteBuffer, so records of up to PSize bytes
+// are contiguous. On a DAX file (pmem, `dax` in Open()) the views are MAP_SYNC
+// and flushes are clwb + sfence from user space, msync otherwise.
+//
+// Single threaded, like CByteBuffer.
+//
+// PSize: Physical buffer size, also the capacity in bytes.
+// VSize: Virtual buffer size, 2x PSize.
+class CJournalByteBuffer
+{
+public:
+    size_t PSize;            // Physical buffer size (multiple of your page size, probably 4096)
+    size_t VSize;            // Virtual buffer size, 2x PSize
+    size_t PageSize;         // Page size backing the buffer
+    std::byte *Data;         // Buffer
+    CJournalHeader *Header;  // Durable Head and Tail
+    int Fd;                  // Journal file, open for as long as the buffer lives
+    bool Pmem;               // MAP_SYNC views of a DAX file: flushed with clwb, not msync
+    uint64_t Head;           // Bytes committed: next push
+    uint64_t Tail;           // Bytes consumed: next pop
+
+    // Opens the journal at `path`, or creates it with room for at least `size`
+    // bytes if it does not exist (or is empty). An existing journal keeps its
+    // own size and recovers Head and Tail from its header.
+    // With `dax`, maps the file MAP_SYNC if it is on a DAX file system
+    // (see Pmem), falls back to msync otherwise.
+    static CJournalByteBuffer Open(const char *path, size_t size, bool dax = false)
+    {
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1)
+        {
+            throw std::runtime_error("open failed");
+        }
+
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t psize = JournalSize(fd, page_size);
+        bool fresh = psize == 0;
+        if (fresh)
+        {
+            psize = ToNextPageSize(size, page_size);
+            if (ftruncate(fd, page_size + psize) == -1)
+            {
+                close(fd);
+                throw std::runtime_error("ftruncate failed");
+            }
+        }
+
+        CJournalByteBuffer journal(fd, psize, dax);
+        if (fresh)
+        {
+            // the magic goes down once the rest of the header is durable
+            journal.Header->PSize = psize;
+            journal.Header->Head.store(0, std::memory_order_relaxed);
+            journal.Header->Tail.store(0, std::memory_order_relaxed);
+            journal.Persist(journal.Header, sizeof(CJournalHeader));
+            journal.Header->Magic.store(CJournalHeader::MAGIC, std::memory_order_release);
+            journal.Persist(journal.Header, sizeof(CJournalHeader));
+        }
+        return journal;
+    };
+
+    CJournalByteBuffer(CJournalByteBuffer &&other) : PSize(other.PSize),
+                                                     VSize(other.VSize),
+                                                     PageSize(other.PageSize),
+                                                     Data(other.Data),
+                                                     Header(other.Header),
+                                                     Fd(other.Fd),
+                                                     Pmem(other.Pmem),
+                                                     Head(other.Head),
+                                                     Tail(other.Tail)
+    {
+        other.Data = nullptr;
+        other.Header = nullptr;
+        other.Fd = -1;
+    };
+
+    // Does not flush: whatever was not flushed is lost, like in a crash
+    ~CJournalByteBuffer()
+    {
+        if (Data != nullptr && munmap(Data, VSize) == -1)
+        {
+            fprintf(stderr, "CJournalByteBuffer Cleanup Error: %s\n", strerror(errno));
+        }
+        if (Header != nullptr && munmap(Header, PageSize) == -1)
+        {
+            fprintf(stderr, "CJournalByteBuffer Cleanup Error: %s\n", strerror(errno));
+        }
+        if (Fd != -1) close(Fd);
+    };
+
+    CJournalByteBuffer(const CJournalByteBuffer &) = delete;
+    CJournalByteBuffer &operator=(const CJournalByteBuffer &) = delete;
+
+    // Free bytes
+    size_t GetPushable() const
+    {
+        return PSize - (Head - Tail);
+    };
+
+    // Bytes between tail and head
+    size_t GetUsed() const
+    {
+        return Head - Tail;
+    };
+
+    bool IsEmpty() const
+    {
+        return Head == Tail;
+    };
+
+    // Committed bytes a crash would lose: not flushed yet
+    size_t GetUnflushed() const
+    {
+        return Head - Header->Head.load(std::memory_order_relaxed);
+    };
+
+    // Contiguous `n` free bytes at head, to be written in place and committed
+    // with Commit(). Empty if `n` bytes are not free.
+    // Flushes first if the bytes are consumed but not as of the last Flush():
+    // to the header they are still live, and a reopen would replay whatever
+    // overwrote them.
+    std::span<std::byte> Reserve(size_t n)
+    {
+        if (GetPushable() < n) return std::span<std::byte>();
+        if (Head + n > Header->Tail.load(std::memory_order_relaxed) + PSize) Flush();
+        return std::span<std::byte>(&Data[Head % PSize], n);
+    };
+
+    // Commits `n` bytes written through Reserve(). Durable after Flush().
+    void Commit(size_t n)
+    {
+        Head += n;
+    };
+
+    // Contiguous `n` bytes at tail, to be read in place and released with
+    // Consume(). Empty if there are fewer than `n` bytes.
+    std::span<const std::byte> Peek(size_t n) const
+    {
+        if (GetUsed() < n) return std::span<const std::byte>();
+        return std::span<const std::byte>(&Data[Tail % PSize], n);
+    };
+
+    // Releases `n` bytes read through Peek(). A reopen replays them until the
+    // next Flush().
+    void Consume(size_t n)
+    {
+        Tail += n;
+    };
+
+    // Returns false (and pushes nothing) if `data` does not fit
+    template <typename T>
+    bool TryPush(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::span<std::byte> out = Reserve(sizeof(T));
+        if (out.empty()) return false;
+        std::memcpy(out.data(), &data, sizeof(T));
+        Commit(sizeof(T));
+        return true;
+    };
+
+    // Returns false (and leaves `data` untouched) if there is no complete T
+    template <typename T>
+    bool TryPop(T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::span<const std::byte> in = Peek(sizeof(T));
+        if (in.empty()) return false;
+        std::memcpy(&data, in.data(), sizeof(T));
+        Consume(sizeof(T));
+        return true;
+    };
+
+    // Persists the bytes of `range`, any span of the buffer (written through
+    // Reserve(), say). Data only: a reopen sees them once Flush() moves the
+    // durable Head past them.
+    void Flush(std::span<const std::byte> range)
+    {
+        if (!range.empty()) Persist(range.data(), range.size());
+    };
+
+    // Persists every committed byte not flushed yet, then Head and Tail:
+    // the commit point of the journal.
+    void Flush()
+    {
+        uint64_t durable_head = Header->Head.load(std::memory_order_relaxed);
+        if (Head == durable_head && Tail == Header->Tail.load(std::memory_order_relaxed)) return;
+
+        // contiguous, even across the end: the mirror. More than a lap since
+        // the last flush is the whole physical buffer, and no more.
+        uint64_t unflushed = Head - durable_head;
+        if (unflushed > PSize) unflushed = PSize;
+        if (unflushed) Persist(&Data[durable_head % PSize], unflushed);
+        Header->Head.store(Head, std::memory_order_release);
+        Header->Tail.store(Tail, std::memory_order_release);
+        Persist(&Header->Head, sizeof(CJournalHeader) - offsetof(CJournalHeader, Head));
+    };
+
+private:
+    // Takes ownership of `fd_`, closed if mapping fails. Head and Tail come
+    // from the header, valid if the file was checked by JournalSize().
+    CJournalByteBuffer(int fd_, size_t psize_, bool dax_) : PSize(psize_),
+                                                            VSize(2*psize_),
+                                                            PageSize(sysconf(_SC_PAGESIZE)),
+                                                            Data(nullptr),
+                                                            Header(nullptr),
+                                                            Fd(fd_),
+                                                            Pmem(false)
+    {
+        int flags = MAP_SHARED;
+        void *header = MAP_FAILED;
+        if (dax_)
+        {
+            // fails (EOPNOTSUPP) unless the file lives on a DAX file system
+            header = mmap(NULL, PageSize, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE | MAP_SYNC, Fd, 0);
+            if (header != MAP_FAILED)
+            {
+                flags = MAP_SHARED_VALIDATE | MAP_SYNC;
+                Pmem = true;
+            }
+        }
+        if (header == MAP_FAILED)
+        {
+            header = mmap(NULL, PageSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+        }
+        if (header == MAP_FAILED)
+        {
+            close(Fd);
+            throw std::runtime_error("Header mapping failed");
+        }
+        Header = static_cast<CJournalHeader *>(header);
+
+        try
+        {
+            Data = static_cast<std::byte *>(MapMirrorFd(Fd, PageSize, PSize, VSize, 0, flags));
+        }
+        catch (...)
+        {
+            munmap(Header, PageSize);
+            close(Fd);
+            throw;
+        }
+
+        Head = Header->Head.load(std::memory_order_acquire);
+        Tail = Header->Tail.load(std::memory_order_acquire);
+    };
+
+    // Makes [addr, addr + n) durable: clwb on pmem, msync of its pages otherwise
+    void Persist(const void *addr, size_t n)
+    {
+        if (Pmem)
+        {
+            WriteBackLines(addr, n);
+            return;
+        }
+        uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(PageSize - 1);
+        if (msync((void *)start, (uintptr_t)addr + n - start, MS_SYNC) == -1)
+        {
+            throw std::runtime_error("msync failed");
+        }
+    };
+
+    // PSize of the journal in `fd`, checked against the file size, 0 for an
+    // empty file or one whose header never got its magic (a crash while
+    // creating it). Closes `fd` if it is not a journal.
+    static size_t JournalSize(int fd, size_t page_size)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == -1)
+        {
+            close(fd);
+            throw std::runtime_error("fstat failed");
+        }
+        if (st.st_size == 0)
+        {
+            return 0;
+        }
+        if ((size_t)st.st_size < 2*page_size)
+        {
+            close(fd);
+            throw std::invalid_argument("CJournalByteBuffer: not a journal");
+        }
+
+        void *header = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (header == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Header mapping failed");
+        }
+        const CJournalHeader *h = static_cast<const CJournalHeader *>(header);
+        uint64_t magic = h->Magic.load(std::memory_order_acquire);
+        uint64_t head = h->Head.load(std::memory_order_relaxed);
+        uint64_t tail = h->Tail.load(std::memory_order_relaxed);
+        size_t psize = h->PSize;
+        munmap(header, page_size);
+        if (magic == 0)
+        {
+            return 0;
+        }
+        if (magic != CJournalHeader::MAGIC || psize + page_size != (size_t)st.st_size ||
+            head < tail || head - tail > psize)
+        {
+            close(fd);
+            throw std::invalid_argument("CJournalByteBuffer: not a journal");
+        }
+        return psize;
+    };
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef C_LOSSY_HPP
+#define C_LOSSY_HPP
+
+#include <span>
+
+#include "cbuffer.hpp"
+
+// Overwrite-oldest byte ring of length framed records, for flight recorders
+// and tracing: Push never blocks and never fails.
+//
+// Every record is a uint32_t payload size followed by the payload. When a push
+// does not fit, the oldest records are dropped, whole, until it does: Tail
+// always sits on a record boundary and the ring never holds more than PSize bytes.
+// The physical buffer is mirrored twice, so any record, and any run of records
+// (Snapshot()), is contiguous.
+// Not thread safe, like CByteBuffer: snapshot from the writer, or stop it first.
+//
+// PSize: Physical buffer size, also the capacity in bytes (framing included).
+// VSize: Virtual buffer size, 2x PSize.
+class CLossyByteBuffer
+{
+public:
+    using Length = uint32_t; // Record framing: payload size
+
+    size_t PSize;     // Physical buffer size (multiple of your page size, probably 4096)
+    size_t VSize;     // Virtual buffer size, 2x PSize
+    size_t PageSize;  // Page size backing the buffer (regular or huge)
+    std::byte *Data;  // Buffer
+    uint64_t Head;    // Bytes pushed: next push
+    uint64_t Tail;    // Bytes dropped or popped: oldest record
+    uint64_t Dropped; // Records overwritten since the last Reset()
+
+    // Physical size is one page, usually 4096 (default)
+    CLossyByteBuffer() : PSize(sysconf(_SC_PAGESIZE)),
+                         VSize(2*PSize)
+    {
+        Allocate(CBufferOptions());
+    };
+
+    // Custom Physical size (must be multiple of page size)
+    CLossyByteBuffer(size_t pbuffer_size_,
+                     const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                          VSize(2*PSize)
+    {
+        Allocate(options_);
+    };
+
+    ~CLossyByteBuffer()
+    {
+        if (Data != nullptr)
+        {
+            if (munmap(Data, VSize) == -1)
+            {
+                const char *error_msg = strerror(errno);
+                fprintf(stderr, "CLossyByteBuffer Cleanup Error: %s\n", error_msg);
+            }
+            Data = nullptr;
+        }
+    };
+
+    CLossyByteBuffer(const CLossyByteBuffer &) = delete;
+    CLossyByteBuffer &operator=(const CLossyByteBuffer &) = delete;
+
+    void Reset()
+    {
+        Head = 0;
+        Tail = 0;
+        Dropped = 0;
+        HeadOffset = 0;
+        TailOffset = 0;
+    };
+
+    // Bytes held, framing included
+    size_t GetSize() const
+    {
+        return Head - Tail;
+    };
+
+    bool IsEmpty() const
+    {
+        return Head == Tail;
+    };
+
+    // Appends a record of `size` bytes, dropping the oldest ones if it does
+    // not fit. `size + sizeof(Length)` must be at most PSize.
+    void Push(const void *data, Length size)
+    {
+        size_t bytes = sizeof(Length) + size;
+        if (__builtin_expect(bytes > PSize, 0))
+        {
+            throw std::invalid_argument("CLossyByteBuffer: record bigger than the buffer");
+        }
+        while (__builtin_expect(Head + bytes - Tail > PSize, 0))
+        {
+            // full: drop the oldest record
+            DropFront();
+            ++Dropped;
+        }
+
+        std::byte *dst = &Data[HeadOffset];
+        std::memcpy(dst, &size, sizeof(Length));
+        BulkCopy(dst + sizeof(Length), data, size);
+        Head += bytes;
+        HeadOffset += bytes;
+        if (HeadOffset >= PSize) HeadOffset -= PSize;
+    };
+
+    template <typename T>
+    void Push(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Push(&data, sizeof(T));
+    };
+
+    // Payload of the oldest record, empty if there is none
+    std::span<const std::byte> Front() const
+    {
+        if (Head == Tail) return std::span<const std::byte>();
+        return std::span<const std::byte>(&Data[TailOffset + sizeof(Length)], LengthAt(TailOffset));
+    };
+
+    // Drops the oldest record, read through Front()
+    void PopFront()
+    {
+        if (Head != Tail) DropFront();
+    };
+
+    // The newest whole records that fit in `n` bytes (framing included),
+    // oldest first, as one contiguous span. Walk it with NextRecord().
+    std::span<const std::byte> Snapshot(size_t n) const
+    {
+        uint64_t start = Tail;
+        size_t offset = TailOffset;
+        while (Head - start > n)
+        {
+            size_t bytes = sizeof(Length) + LengthAt(offset);
+            start += bytes;
+            offset += bytes;
+            if (offset >= PSize) offset -= PSize;
+        }
+        return std::span<const std::byte>(&Data[offset], Head - start);
+    };
+
+    // Payload of the first record of `records` (from Snapshot()), and moves
+    // `records` past it. Empty once `records` is.
+    static std::span<const std::byte> NextRecord(std::span<const std::byte> &records)
+    {
+        if (records.size() < sizeof(Length)) return std::span<const std::byte>();
+        Length size;
+        std::memcpy(&size, records.data(), sizeof(Length));
+        std::span<const std::byte> payload = records.subspan(sizeof(Length), size);
+        records = records.subspan(sizeof(Length) + size);
+        return payload;
+    };
+
+private:
+    size_t HeadOffset; // Head % PSize
+    size_t TailOffset; // Tail % PSize
+
+    Length LengthAt(size_t offset) const
+    {
+        Length size;
+        std::memcpy(&size, &Data[offset], sizeof(Length));
+        return size;
+    };
+
+    void DropFront()
+    {
+        size_t bytes = sizeof(Length) + LengthAt(TailOffset);
+        Tail += bytes;
+        TailOffset += bytes;
+        if (TailOffset >= PSize) TailOffset -= PSize;
+    };
+
+    void Allocate(const CBufferOptions &options)
+    {
+        Data = static_cast<std::byte*>(AllocateMirror(PSize, VSize, PageSize, "CLossyByteBuffer", options));
+        Reset();
+    };
+};
+
+#endif
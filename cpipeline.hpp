@@ -0,0 +1,108 @@
+#ifndef C_PIPELINE_HPP
+#define C_PIPELINE_HPP
+
+#include <atomic>
+#include <span>
+#include <thread>
+
+#include "cqueue.hpp"
+
+// What a transform did with the spans it was given
+struct CTransformResult
+{
+    size_t Consumed; // Input bytes done with, released from the input ring
+    size_t Produced; // Output bytes written, published to the output ring
+};
+
+// One stage of a pipeline of CSpscByteBuffers: consumer of `Input`, producer of
+// `Output`. Each Step() hands the transform all the bytes ready in Input and
+// all the room free in Output, both contiguous in place (the mirrors), and
+// commits what it reports: one pass over the data, no scratch buffers.
+//
+// The transform is any callable
+//     CTransformResult (std::span<const std::byte> in, std::span<std::byte> out)
+// It consumes whole records (or none) and may leave bytes for the next step,
+// when a record is incomplete or the output is short of room: that is the
+// backpressure, a full Output holds the stage, which holds Input.
+//
+// Stages chain across threads, each one Run() by its own: the output ring of
+// a stage is the input ring of the next, and each stage stops once the one
+// before it is Done and it has nothing left to do. Steps wake a neighbour
+// parked in a blocking Push / Pop, whatever strategy it waits with.
+template <typename F>
+class CPipelineStage
+{
+public:
+    CSpscByteBuffer &Input;  // Ring this stage pops from
+    CSpscByteBuffer &Output; // Ring this stage pushes to
+    F Transform;             // in / out spans to CTransformResult
+    size_t MaxChunk;         // Most input bytes handed over per step
+    std::atomic<bool> Done;  // Set when Run() returns: the next stage's `upstream`
+
+    // `max_chunk_` caps the input span (0 for Input.PSize): smaller chunks
+    // hand bytes on sooner
+    CPipelineStage(CSpscByteBuffer &input_,
+                   CSpscByteBuffer &output_,
+                   F transform_,
+                   size_t max_chunk_ = 0) : Input(input_),
+                                            Output(output_),
+                                            Transform(transform_),
+                                            MaxChunk(max_chunk_ ? max_chunk_ : input_.PSize),
+                                            Done(false)
+    {
+    };
+
+    CPipelineStage(const CPipelineStage &) = delete;
+    CPipelineStage &operator=(const CPipelineStage &) = delete;
+
+    // One pass: transforms what is ready in Input into what is free in
+    // Output, then publishes the output before releasing the input.
+    // Returns what the transform did, {0, 0} if it could not move.
+    CTransformResult Step()
+    {
+        size_t ready = Input.GetPoppable();
+        if (ready > MaxChunk) ready = MaxChunk;
+        if (ready == 0) return CTransformResult{0, 0};
+
+        std::span<const std::byte> in = Input.Peek(ready);
+        std::span<std::byte> out = Output.Reserve(Output.GetPushable());
+        CTransformResult result = Transform(in, out);
+        assert(result.Consumed <= in.size() && result.Produced <= out.size());
+
+        if (result.Produced) Output.Publish(result.Produced);
+        if (result.Consumed) Input.Release(result.Consumed);
+        return result;
+    };
+
+    // Steps until `upstream` is set and nothing is left to do: Input is
+    // empty, or the transform will not take what is left even with all of
+    // Output free (a truncated last record). Spins a little, then yields,
+    // while there is nothing to do. Sets Done on the way out.
+    void Run(const std::atomic<bool> &upstream)
+    {
+        size_t idle = 0;
+        for (;;)
+        {
+            // before Step(): once it is set, every byte upstream pushed is visible.
+            // Output too: only a step refused with all of it free proves the
+            // record truncated, downstream may free room while Step() runs.
+            bool finished = upstream.load(std::memory_order_acquire);
+            bool drained = Output.GetPushable() == Output.PSize;
+            CTransformResult result = Step();
+            if (result.Consumed || result.Produced)
+            {
+                idle = 0;
+                continue;
+            }
+            if (finished && (Input.IsEmpty() || drained))
+            {
+                break;
+            }
+            if (++idle < 64) _mm_pause();
+            else std::this_thread::yield();
+        }
+        Done.store(true, std::memory_order_release);
+    };
+};
+
+#endif
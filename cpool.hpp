@@ -0,0 +1,142 @@
+#ifndef C_POOL_HPP
+#define C_POOL_HPP
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+#include "cbuffer.hpp"
+
+// Pool of pre-mapped CByteBuffers, in size classes.
+//
+// Setting up a CByteBuffer means a virtual reservation, a memfd and one mmap per
+// view, and tearing it down is a munmap. The pool pays that once, up front:
+// Acquire() and Release() are O(1), and never call into the kernel.
+//
+// Each size class keeps its free buffers in a lock-free freelist (Treiber stack).
+// The freelist head packs a tag next to the index of the top buffer, bumped
+// on every change, so a pop racing with a pop-push of the same buffer (ABA)
+// fails its CAS instead of corrupting the list.
+class CBufferPool
+{
+public:
+    // `count_` buffers of each of `sizes_`. Buffers use the double mapping by
+    // default, so a big pool does not run out of address space or VMAs.
+    CBufferPool(const std::vector<size_t> &sizes_,
+                size_t count_,
+                const CBufferOptions &options_ = CBufferOptions{MirrorMode::Double})
+    {
+        std::vector<size_t> sizes(sizes_);
+        std::sort(sizes.begin(), sizes.end());
+        for (size_t c = 0; c < sizes.size(); ++c)
+        {
+            auto cls = std::make_unique<SizeClass>();
+            cls->Size = ToNextPageSize(sizes[c]);
+            cls->Next.reset(new std::atomic<uint32_t>[count_]);
+            cls->Free.store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < count_; ++i)
+            {
+                cls->Buffers.emplace_back(std::make_unique<CByteBuffer>(cls->Size, options_));
+                Index[cls->Buffers.back().get()] = {static_cast<uint32_t>(c), static_cast<uint32_t>(i)};
+                Push(*cls, i);
+            }
+            Classes.push_back(std::move(cls));
+        }
+    };
+
+    CBufferPool(const CBufferPool &) = delete;
+    CBufferPool &operator=(const CBufferPool &) = delete;
+
+    // A buffer with PSize of at least `size`, from the smallest class that has
+    // one free. nullptr if all fitting classes are exhausted.
+    CByteBuffer *Acquire(size_t size)
+    {
+        for (auto &cls : Classes)
+        {
+            if (cls->Size < size) continue;
+            uint32_t i;
+            if (Pop(*cls, i))
+            {
+                return cls->Buffers[i].get();
+            }
+        }
+        return nullptr;
+    };
+
+    // Gives back a buffer from Acquire(), Reset() for the next user
+    void Release(CByteBuffer *buffer)
+    {
+        auto it = Index.find(buffer);
+        if (it == Index.end())
+        {
+            throw std::invalid_argument("CBufferPool: buffer does not belong to this pool");
+        }
+        buffer->Reset();
+        Push(*Classes[it->second.first], it->second.second);
+    };
+
+    // Free buffers in the class of `size`. Only exact when no one is acquiring or releasing.
+    size_t GetFreeCount(size_t size) const
+    {
+        for (auto &cls : Classes)
+        {
+            if (cls->Size < size) continue;
+            size_t count = 0;
+            for (uint32_t top = cls->Free.load(std::memory_order_acquire); top != 0;
+                 top = cls->Next[top - 1].load(std::memory_order_relaxed))
+            {
+                ++count;
+            }
+            return count;
+        }
+        return 0;
+    };
+
+private:
+    struct SizeClass
+    {
+        size_t Size;                                       // PSize of the buffers
+        std::vector<std::unique_ptr<CByteBuffer>> Buffers; // All buffers of the class
+        std::unique_ptr<std::atomic<uint32_t>[]> Next;     // Freelist links: index + 1, 0 ends the list
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Free; // Freelist head: tag << 32 | (index + 1)
+    };
+
+    std::vector<std::unique_ptr<SizeClass>> Classes; // Sorted by size
+    std::unordered_map<const CByteBuffer *, std::pair<uint32_t, uint32_t>> Index; // Buffer to (class, index), read only after construction
+
+    static uint64_t NextHead(uint64_t head, uint32_t top)
+    {
+        return (((head >> 32) + 1) << 32) | top;
+    };
+
+    static void Push(SizeClass &cls, uint32_t i)
+    {
+        uint64_t head = cls.Free.load(std::memory_order_relaxed);
+        do
+        {
+            cls.Next[i].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        } while (!cls.Free.compare_exchange_weak(head, NextHead(head, i + 1),
+                                                 std::memory_order_release, std::memory_order_relaxed));
+    };
+
+    static bool Pop(SizeClass &cls, uint32_t &i)
+    {
+        uint64_t head = cls.Free.load(std::memory_order_acquire);
+        for (;;)
+        {
+            uint32_t top = static_cast<uint32_t>(head);
+            if (top == 0) return false;
+            uint32_t next = cls.Next[top - 1].load(std::memory_order_relaxed);
+            if (cls.Free.compare_exchange_weak(head, NextHead(head, next),
+                                               std::memory_order_acquire, std::memory_order_acquire))
+            {
+                i = top - 1;
+                return true;
+            }
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,1203 @@
+#ifndef C_QUEUE_HPP
+#define C_QUEUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <bit>
+#include <iterator>
+#include <ranges>
+#include <new>
+#include <linux/futex.h>
+
+#include "cbuffer.hpp"
+
+// Futex on the low 32 bits of a 64 bit index (little endian)
+inline uint32_t *FutexWord(std::atomic<uint64_t> &index)
+{
+    static_assert(std::endian::native == std::endian::little);
+    return reinterpret_cast<uint32_t *>(&index);
+}
+
+// Sleeps while the low 32 bits of `index` are `seen` (or until woken)
+inline void FutexSleep(std::atomic<uint64_t> &index, uint32_t seen)
+{
+    syscall(SYS_futex, FutexWord(index), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<uint64_t> &index)
+{
+    syscall(SYS_futex, FutexWord(index), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+// Wait strategies for the blocking CSpscByteBuffer calls: how long to spin
+// before parking in the kernel (futex on the other side's Head or Tail).
+// Any struct with the same three members will do. The two sides may use
+// different ones: a parked side is woken whatever the other side waits with.
+//
+// Busy-spin: lowest latency, burns a core while waiting. Never parks, so the
+// other side never pays for a wakeup.
+struct SpinWait
+{
+    static constexpr size_t SPINS = SIZE_MAX;
+    static constexpr bool PARKS = false;
+    static void Pause() { _mm_pause(); }
+};
+
+// Spin for a while (covers a busy peer), then park: low latency under load,
+// next to no CPU when idle.
+struct SpinFutexWait
+{
+    static constexpr size_t SPINS = 4096;
+    static constexpr bool PARKS = true;
+    static void Pause() { _mm_pause(); }
+};
+
+// Park right away: the least CPU, a wakeup (a few us) on every wait.
+struct FutexWait
+{
+    static constexpr size_t SPINS = 0;
+    static constexpr bool PARKS = true;
+    static void Pause() { _mm_pause(); }
+};
+
+// Single-producer/single-consumer CByteBuffer: one thread pushes, one thread
+// pops, no locks.
+//
+// The physical buffer is mirrored exactly twice, so any record of up to PSize
+// bytes is contiguous in virtual memory. Head and Tail count bytes since the
+// last Reset() and never wrap, the offsets into Data are kept apart.
+// Each side keeps a cached copy of the other side's index, and only reloads
+// it when the cached copy says the buffer is full (or empty).
+//
+// PSize: Physical buffer size, also the capacity in bytes.
+// VSize: Virtual buffer size, 2x PSize.
+class CSpscByteBuffer
+{
+public:
+    size_t PSize;    // Physical buffer size (multiple of your page size, probably 4096)
+    size_t VSize;    // Virtual buffer size, 2x PSize
+    size_t PageSize; // Page size backing the buffer (regular or huge)
+    std::byte *Data; // Buffer
+
+    // Producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Bytes pushed: next push
+    uint64_t CachedTail;                                 // Last Tail seen by the producer
+    size_t HeadOffset;                                   // Head % PSize
+
+    // Consumer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Tail; // Bytes popped: next pop
+    uint64_t CachedHead;                                 // Last Head seen by the consumer
+    size_t TailOffset;                                   // Tail % PSize
+
+    // Blocking calls: a side sets its flag before parking, the other side
+    // only enters the kernel to wake it when it is set. Rarely written.
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> ProducerParked; // Producer sleeps on Tail
+    std::atomic<uint32_t> ConsumerParked;                           // Consumer sleeps on Head
+
+    // Hot path counters, empty without CBUFFER_STATS. A stall is a try that
+    // failed after reloading the other side's index; blocking waits are not
+    // counted, the tries that follow them are.
+    [[no_unique_address]] CBufferStatsType Stats;
+
+    // Physical size is one page, usually 4096 (default)
+    CSpscByteBuffer() : PSize(sysconf(_SC_PAGESIZE)),
+                        VSize(2*PSize)
+    {
+        Allocate(CBufferOptions());
+    };
+
+    // Custom Physical size (must be multiple of page size)
+    CSpscByteBuffer(size_t pbuffer_size_,
+                    const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                         VSize(2*PSize)
+    {
+        Allocate(options_);
+    };
+
+    ~CSpscByteBuffer()
+    {
+        if (Data != nullptr)
+        {
+            if (munmap(Data, VSize) == -1)
+            {
+                const char *error_msg = strerror(errno);
+                fprintf(stderr, "CSpscByteBuffer Cleanup Error: %s\n", error_msg);
+            }
+            Data = nullptr;
+        }
+    };
+
+    CSpscByteBuffer(const CSpscByteBuffer &) = delete;
+    CSpscByteBuffer &operator=(const CSpscByteBuffer &) = delete;
+
+    // Not thread safe: no one may be pushing or popping
+    void Reset()
+    {
+        Head.store(0, std::memory_order_relaxed);
+        Tail.store(0, std::memory_order_relaxed);
+        CachedTail = 0;
+        CachedHead = 0;
+        HeadOffset = 0;
+        TailOffset = 0;
+        ProducerParked.store(0, std::memory_order_relaxed);
+        ConsumerParked.store(0, std::memory_order_relaxed);
+        Stats.Reset();
+    };
+
+    // Counters since the last Reset(), all zeros without CBUFFER_STATS. Any
+    // thread. HighWater is as the producer saw it, through CachedTail: an
+    // upper bound.
+    CBufferStatsSnapshot GetStats() const
+    {
+        return Stats.Snapshot();
+    };
+
+    // Free bytes. Exact when called by the producer.
+    size_t GetPushable() const
+    {
+        return PSize - (Head.load(std::memory_order_relaxed) - Tail.load(std::memory_order_acquire));
+    };
+
+    // Bytes ready to pop. Exact when called by the consumer.
+    size_t GetPoppable() const
+    {
+        return Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_relaxed);
+    };
+
+    bool IsEmpty() const
+    {
+        return Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_acquire);
+    };
+
+    bool IsFull() const
+    {
+        return Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_acquire) == PSize;
+    };
+
+    // Producer only. Returns false (and pushes nothing) if `data` does not fit.
+    template <typename T>
+    bool TryPush(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        if (__builtin_expect(PSize - (head - CachedTail) < sizeof(T), 0))
+        {
+            // looks full, check what the consumer has freed since
+            CachedTail = Tail.load(std::memory_order_acquire);
+            if (PSize - (head - CachedTail) < sizeof(T))
+            {
+                Stats.FullStall();
+                return false;
+            }
+        }
+
+        // the mirror makes this contiguous, even across the end of the physical buffer
+        *reinterpret_cast<T*>(&Data[HeadOffset]) = data;
+        HeadOffset += sizeof(T);
+        if (HeadOffset >= PSize) HeadOffset -= PSize;
+        Head.store(head + sizeof(T), std::memory_order_release);
+        Stats.Pushed(sizeof(T), head + sizeof(T) - CachedTail, HeadOffset < sizeof(T));
+        return true;
+    };
+
+    // Consumer only. Returns false (and leaves `data` untouched) if there is
+    // no complete T to pop.
+    template <typename T>
+    bool TryPop(T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        if (__builtin_expect(CachedHead - tail < sizeof(T), 0))
+        {
+            // looks empty, check what the producer has pushed since
+            CachedHead = Head.load(std::memory_order_acquire);
+            if (CachedHead - tail < sizeof(T))
+            {
+                Stats.EmptyStall();
+                return false;
+            }
+        }
+
+        data = *reinterpret_cast<const T*>(&Data[TailOffset]);
+        TailOffset += sizeof(T);
+        if (TailOffset >= PSize) TailOffset -= PSize;
+        Tail.store(tail + sizeof(T), std::memory_order_release);
+        Stats.Popped(sizeof(T), TailOffset < sizeof(T));
+        return true;
+    };
+
+    // Producer only. Contiguous `n` free bytes at head, to be written in place
+    // and published with Commit(). Empty if `n` bytes are not free.
+    std::span<std::byte> Reserve(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        if (PSize - (head - CachedTail) < n)
+        {
+            CachedTail = Tail.load(std::memory_order_acquire);
+            if (PSize - (head - CachedTail) < n)
+            {
+                Stats.FullStall();
+                return std::span<std::byte>();
+            }
+        }
+        return std::span<std::byte>(&Data[HeadOffset], n);
+    };
+
+    // Producer only. Publishes `n` bytes written through Reserve()
+    void Commit(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        HeadOffset += n;
+        if (HeadOffset >= PSize) HeadOffset -= PSize;
+        Head.store(head + n, std::memory_order_release);
+        Stats.Pushed(n, head + n - CachedTail, HeadOffset < n);
+    };
+
+    // Consumer only. Contiguous `n` ready bytes at tail, to be read in place
+    // and released with Consume(). Empty if `n` bytes are not ready.
+    std::span<const std::byte> Peek(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        if (CachedHead - tail < n)
+        {
+            CachedHead = Head.load(std::memory_order_acquire);
+            if (CachedHead - tail < n)
+            {
+                Stats.EmptyStall();
+                return std::span<const std::byte>();
+            }
+        }
+        return std::span<const std::byte>(&Data[TailOffset], n);
+    };
+
+    // Consumer only. Releases `n` bytes read through Peek()
+    void Consume(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        TailOffset += n;
+        if (TailOffset >= PSize) TailOffset -= PSize;
+        Tail.store(tail + n, std::memory_order_release);
+        Stats.Popped(n, TailOffset < n);
+    };
+
+    // Producer only. Pushes all `n` items, or none if they do not fit.
+    template <typename T>
+    bool TryPushN(const T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        size_t bytes = n * sizeof(T);
+        std::span<std::byte> out = Reserve(bytes);
+        if (out.size() != bytes) return false;
+        BulkCopy(out.data(), data, bytes);
+        Commit(bytes);
+        return true;
+    };
+
+    // Consumer only. Pops exactly `n` items, or none if they are not ready.
+    template <typename T>
+    bool TryPopN(T* data, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        size_t bytes = n * sizeof(T);
+        std::span<const std::byte> in = Peek(bytes);
+        if (in.size() != bytes) return false;
+        BulkCopy(data, in.data(), bytes);
+        Consume(bytes);
+        return true;
+    };
+
+    // Producer only. Waits, following `W`, until `n` bytes are free.
+    // Returns the free bytes.
+    template <typename W = SpinFutexWait>
+    size_t WaitPushable(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        Await<W>(Tail, ProducerParked, [&]() {
+            CachedTail = Tail.load(std::memory_order_acquire);
+            return PSize - (head - CachedTail) >= n;
+        });
+        return PSize - (head - CachedTail);
+    };
+
+    // Consumer only. Waits, following `W`, until `n` bytes are ready.
+    // Returns the ready bytes.
+    template <typename W = SpinFutexWait>
+    size_t WaitPoppable(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        Await<W>(Head, ConsumerParked, [&]() {
+            CachedHead = Head.load(std::memory_order_acquire);
+            return CachedHead - tail >= n;
+        });
+        return CachedHead - tail;
+    };
+
+    // Producer only. Commit(), then wakes the consumer if it is parked,
+    // whatever strategy it waits with.
+    void Publish(size_t n)
+    {
+        Commit(n);
+        Wake(Head, ConsumerParked);
+    };
+
+    // Consumer only. Consume(), then wakes the producer if it is parked.
+    void Release(size_t n)
+    {
+        Consume(n);
+        Wake(Tail, ProducerParked);
+    };
+
+    // Producer only. Waits for room, following `W`, and pushes `data`.
+    template <typename W = SpinFutexWait, typename T>
+    void Push(const T& data)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        WaitPushable<W>(sizeof(T));
+        std::memcpy(Reserve(sizeof(T)).data(), &data, sizeof(T));
+        Publish(sizeof(T));
+    };
+
+    // Consumer only. Waits for a T, following `W`, and pops it.
+    template <typename T, typename W = SpinFutexWait>
+    T Pop()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        WaitPoppable<W>(sizeof(T));
+        T data;
+        std::memcpy(&data, Peek(sizeof(T)).data(), sizeof(T));
+        Release(sizeof(T));
+        return data;
+    };
+
+    // Producer only. Reads up to `max` bytes (or as many as are free) from
+    // `fd` straight into the buffer: one read(), the mirror makes them contiguous.
+    // Returns the bytes read and pushed, 0 on end of file or when full, -1 on error (errno).
+    ssize_t ReadFrom(int fd, size_t max)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        CachedTail = Tail.load(std::memory_order_acquire);
+        size_t free = PSize - (head - CachedTail);
+        if (max > free) max = free;
+        if (max == 0) return 0;
+        ssize_t n = read(fd, &Data[HeadOffset], max);
+        if (n > 0) Commit(n);
+        return n;
+    };
+
+    // Consumer only. Writes up to `max` bytes (or as many as are ready) to
+    // `fd` straight from the buffer: one write().
+    // Returns the bytes written and popped, 0 when empty, -1 on error (errno).
+    ssize_t WriteTo(int fd, size_t max)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        CachedHead = Head.load(std::memory_order_acquire);
+        size_t ready = CachedHead - tail;
+        if (max > ready) max = ready;
+        if (max == 0) return 0;
+        ssize_t n = write(fd, &Data[TailOffset], max);
+        if (n > 0) Consume(n);
+        return n;
+    };
+
+private:
+    void Allocate(const CBufferOptions &options)
+    {
+        Data = static_cast<std::byte*>(AllocateMirror(PSize, VSize, PageSize, "CSpscByteBuffer", options));
+        Reset();
+    };
+
+    // Until `ready()`: spins, then parks on `index` (the other side's),
+    // with `parked` set so the other side knows to wake us.
+    template <typename W, typename F>
+    void Await(std::atomic<uint64_t> &index, std::atomic<uint32_t> &parked, F ready)
+    {
+        for (size_t i = 0; i < W::SPINS; ++i)
+        {
+            if (ready()) return;
+            W::Pause();
+        }
+        if constexpr (W::PARKS)
+        {
+            for (;;)
+            {
+                uint32_t seen = static_cast<uint32_t>(index.load(std::memory_order_relaxed));
+                parked.store(1, std::memory_order_relaxed);
+                // the flag store must be visible before we check `index` again,
+                // the other side does the opposite in Wake(): one of us sees the other
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (ready()) break;
+                FutexSleep(index, seen);
+            }
+            parked.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    // After moving `index`: wakes the other side if it parked on it. Checked
+    // whatever this side's strategy: a SpinWait side still wakes a parked
+    // FutexWait one. The fence is all it costs when no one parked.
+    void Wake(std::atomic<uint64_t> &index, std::atomic<uint32_t> &parked)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed))
+        {
+            FutexWake(index);
+        }
+    };
+};
+
+// Bounded multi-producer/multi-consumer queue of T, slots stored in a CBuffer<T>.
+//
+// Vyukov style: every slot has a sequence number saying whose turn it is.
+// The slot of position p is free for its producer when its sequence is p,
+// and ready for its consumer when its sequence is p + 1. Producers and
+// consumers only contend on Head (or Tail) to claim positions.
+// Batch claims take n consecutive positions with a single CAS, and thanks to
+// the mirror the n slots are always contiguous: one memcpy, no split copy.
+//
+// Capacity: Items in the physical buffer. PSize must be a multiple of sizeof(T).
+template <typename T>
+class CMpmcBuffer
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "CMpmcBuffer requires a trivially copyable type.");
+
+public:
+    CBuffer<T> Slots;                                  // Slot storage
+    size_t Capacity;                                   // Max items in the queue
+    std::unique_ptr<std::atomic<uint64_t>[]> Sequence; // Per slot sequence numbers
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Next position to push
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Tail; // Next position to pop
+
+    // Room for at least `count_` items, rounded up to a multiple of page size
+    CMpmcBuffer(size_t count_) : Slots(count_*sizeof(T)),
+                                 Capacity(Slots.GetPItemCount()),
+                                 Sequence(new std::atomic<uint64_t>[Capacity])
+    {
+        if (Slots.PSize % sizeof(T) != 0)
+        {
+            throw std::invalid_argument("CMpmcBuffer: page size must be a multiple of sizeof(T)");
+        }
+        Reset();
+    };
+
+    CMpmcBuffer(const CMpmcBuffer &) = delete;
+    CMpmcBuffer &operator=(const CMpmcBuffer &) = delete;
+
+    // Not thread safe: no one may be pushing or popping
+    void Reset()
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            Sequence[i].store(i, std::memory_order_relaxed);
+        }
+        Head.store(0, std::memory_order_relaxed);
+        Tail.store(0, std::memory_order_release);
+    };
+
+    // Approximate item count, exact only when no one is pushing or popping
+    size_t GetSize() const
+    {
+        uint64_t tail = Tail.load(std::memory_order_acquire);
+        uint64_t head = Head.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    };
+
+    // Returns false if the queue is full
+    bool TryPush(const T& data)
+    {
+        return TryPushN(&data, 1);
+    };
+
+    // Returns false if the queue is empty
+    bool TryPop(T& data)
+    {
+        return TryPopN(&data, 1);
+    };
+
+    // Pushes all `n` items, or none if there are not `n` free slots.
+    bool TryPushN(const T* src, size_t n)
+    {
+        if (n > Capacity) return false;
+        uint64_t pos;
+        if (!Claim(Head, 0, n, pos)) return false;
+
+        BulkCopy(&Slots[Index(pos)], src, n * sizeof(T));
+        for (size_t i = 0; i < n; ++i)
+        {
+            Sequence[Index(pos + i)].store(pos + i + 1, std::memory_order_release);
+        }
+        return true;
+    };
+
+    // Pops exactly `n` items, or none if there are not `n` ready items.
+    bool TryPopN(T* dst, size_t n)
+    {
+        if (n > Capacity) return false;
+        uint64_t pos;
+        if (!Claim(Tail, 1, n, pos)) return false;
+
+        BulkCopy(dst, &Slots[Index(pos)], n * sizeof(T));
+        for (size_t i = 0; i < n; ++i)
+        {
+            Sequence[Index(pos + i)].store(pos + i + Capacity, std::memory_order_release);
+        }
+        return true;
+    };
+
+private:
+    size_t Index(uint64_t pos) const
+    {
+        return (Capacity & (Capacity - 1)) == 0 ? pos & (Capacity - 1) : pos % Capacity;
+    };
+
+    // Claims `n` consecutive positions from `cursor` (Head or Tail).
+    // The slot of position p is ours when its sequence is p + `turn`
+    // (0 for producers, 1 for consumers).
+    bool Claim(std::atomic<uint64_t>& cursor, uint64_t turn, size_t n, uint64_t& pos)
+    {
+        pos = cursor.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            int64_t diff = 0;
+            size_t i = 0;
+            for (; i < n; ++i)
+            {
+                uint64_t seq = Sequence[Index(pos + i)].load(std::memory_order_acquire);
+                diff = static_cast<int64_t>(seq - (pos + i + turn));
+                if (diff != 0) break;
+            }
+
+            if (i == n)
+            {
+                // all n slots are ours to take, unless someone moved the cursor
+                if (cursor.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the slot is still a lap behind: full (or empty)
+                return false;
+            }
+            else
+            {
+                // someone else claimed it already
+                pos = cursor.load(std::memory_order_relaxed);
+            }
+        }
+    };
+};
+
+// Single-producer/single-consumer queue of T over a CBuffer<T>, mirrored
+// twice: every run of ready items is contiguous, so the consumer reads them in
+// place, as one std::span (FrontSpan), and hands them on without a copy.
+//
+// Head and Tail count items since the last Reset() and never wrap. Like
+// CSpscByteBuffer, each side caches the other side's index.
+//
+// Capacity: Items in the physical buffer. PSize must be a multiple of sizeof(T).
+template <typename T>
+class CSpscQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "CSpscQueue requires a trivially copyable type.");
+
+public:
+    CBuffer<T> Slots; // Item storage, mirrored twice
+    size_t Capacity;  // Max items in the queue
+
+    // Producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Items pushed: next push
+    uint64_t CachedTail;                                 // Last Tail seen by the producer
+
+    // Consumer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Tail; // Items popped: next pop
+    uint64_t CachedHead;                                 // Last Head seen by the consumer
+
+    // Room for at least `count_` items, rounded up to a multiple of page size
+    CSpscQueue(size_t count_,
+               const CBufferOptions &options_ = CBufferOptions()) : Slots(count_*sizeof(T), 2, options_),
+                                                                    Capacity(Slots.GetPItemCount())
+    {
+        if (Slots.PSize % sizeof(T) != 0 || Slots.GetPageCount() < 2)
+        {
+            throw std::invalid_argument("CSpscQueue: page size must be a multiple of sizeof(T), and the buffer mirrored");
+        }
+        Reset();
+    };
+
+    CSpscQueue(const CSpscQueue &) = delete;
+    CSpscQueue &operator=(const CSpscQueue &) = delete;
+
+    // Not thread safe: no one may be pushing or popping
+    void Reset()
+    {
+        Head.store(0, std::memory_order_relaxed);
+        Tail.store(0, std::memory_order_relaxed);
+        CachedTail = 0;
+        CachedHead = 0;
+        HeadIndex = 0;
+        TailIndex = 0;
+    };
+
+    // Item count. Exact when called by the producer or the consumer.
+    size_t GetSize() const
+    {
+        return Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_acquire);
+    };
+
+    bool IsEmpty() const
+    {
+        return GetSize() == 0;
+    };
+
+    // Producer only. Constructs an item at head from `args`.
+    // Returns false (and constructs nothing) if full.
+    template <typename... Args>
+    bool TryEmplace(Args&&... args)
+    {
+        if (__builtin_expect(Free(1) == 0, 0)) return false;
+        new (&Slots.Data[HeadIndex]) T(std::forward<Args>(args)...);
+        Publish(1);
+        return true;
+    };
+
+    // Producer only. Returns false if full.
+    bool TryPush(const T& item)
+    {
+        return TryEmplace(item);
+    };
+
+    // Producer only. Pushes as many items of [first, last) as fit, in order,
+    // returns how many. One BulkCopy for contiguous ranges.
+    template <std::forward_iterator It>
+    size_t PushRange(It first, It last)
+    {
+        size_t n = Free(static_cast<size_t>(std::distance(first, last)));
+        T *out = &Slots.Data[HeadIndex];
+        if constexpr (std::contiguous_iterator<It>)
+        {
+            BulkCopy(out, std::to_address(first), n * sizeof(T));
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i, ++first) out[i] = *first;
+        }
+        Publish(n);
+        return n;
+    };
+
+    template <std::ranges::forward_range R>
+        requires std::ranges::common_range<R>
+    size_t PushRange(R&& range)
+    {
+        return PushRange(std::ranges::begin(range), std::ranges::end(range));
+    };
+
+    // Consumer only. Up to `n` ready items at tail, oldest first: always
+    // contiguous, across the end of the physical buffer too. Empty if none.
+    // The items stay in the queue until Pop().
+    std::span<T> FrontSpan(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        if (CachedHead - tail < n)
+        {
+            CachedHead = Head.load(std::memory_order_acquire);
+        }
+        size_t ready = CachedHead - tail;
+        return std::span<T>(&Slots.Data[TailIndex], ready < n ? ready : n);
+    };
+
+    // Consumer only. Releases the first `n` items, at most FrontSpan() returned
+    void Pop(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        TailIndex += n;
+        if (TailIndex >= Capacity) TailIndex -= Capacity;
+        Tail.store(tail + n, std::memory_order_release);
+    };
+
+    // Consumer only. Returns false (and leaves `item` untouched) if empty.
+    bool TryPop(T& item)
+    {
+        std::span<T> in = FrontSpan(1);
+        if (in.empty()) return false;
+        item = in[0];
+        Pop(1);
+        return true;
+    };
+
+private:
+    size_t HeadIndex; // Head % Capacity
+    size_t TailIndex; // Tail % Capacity
+
+    // Free slots, up to `n`. Only reloads Tail if the cached one says fewer.
+    size_t Free(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        if (Capacity - (head - CachedTail) < n)
+        {
+            CachedTail = Tail.load(std::memory_order_acquire);
+        }
+        size_t free = Capacity - (head - CachedTail);
+        return free < n ? free : n;
+    };
+
+    void Publish(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        HeadIndex += n;
+        if (HeadIndex >= Capacity) HeadIndex -= Capacity;
+        Head.store(head + n, std::memory_order_release);
+    };
+};
+
+// Multi-producer/single-consumer queue of T over a CBuffer<T>, with the same
+// consumer side as CSpscQueue: FrontSpan() gives the ready items at tail as one
+// contiguous std::span.
+//
+// Producers claim slots like CMpmcBuffer (Vyukov sequence numbers, one CAS on
+// Head for a whole range) and mark each slot ready once written, so slots may
+// be ready out of order. FrontSpan stops at the first one that is not.
+//
+// Capacity: Items in the physical buffer. PSize must be a multiple of sizeof(T).
+template <typename T>
+class CMpscQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "CMpscQueue requires a trivially copyable type.");
+
+public:
+    CBuffer<T> Slots;                                  // Item storage, mirrored twice
+    size_t Capacity;                                   // Max items in the queue
+    std::unique_ptr<std::atomic<uint64_t>[]> Sequence; // Per slot sequence numbers
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Next position to claim
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Tail; // Next position to pop, consumer only
+
+    // Room for at least `count_` items, rounded up to a multiple of page size
+    CMpscQueue(size_t count_,
+               const CBufferOptions &options_ = CBufferOptions()) : Slots(count_*sizeof(T), 2, options_),
+                                                                    Capacity(Slots.GetPItemCount()),
+                                                                    Sequence(new std::atomic<uint64_t>[Capacity])
+    {
+        if (Slots.PSize % sizeof(T) != 0 || Slots.GetPageCount() < 2)
+        {
+            throw std::invalid_argument("CMpscQueue: page size must be a multiple of sizeof(T), and the buffer mirrored");
+        }
+        Reset();
+    };
+
+    CMpscQueue(const CMpscQueue &) = delete;
+    CMpscQueue &operator=(const CMpscQueue &) = delete;
+
+    // Not thread safe: no one may be pushing or popping
+    void Reset()
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            Sequence[i].store(i, std::memory_order_relaxed);
+        }
+        Head.store(0, std::memory_order_relaxed);
+        Tail.store(0, std::memory_order_release);
+    };
+
+    // Approximate item count, exact only when no one is pushing or popping
+    size_t GetSize() const
+    {
+        uint64_t tail = Tail.load(std::memory_order_acquire);
+        uint64_t head = Head.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    };
+
+    // Constructs an item from `args` in a claimed slot.
+    // Returns false (and constructs nothing) if full.
+    template <typename... Args>
+    bool TryEmplace(Args&&... args)
+    {
+        uint64_t pos;
+        if (Claim(1, pos) == 0) return false;
+        new (&Slots.Data[Index(pos)]) T(std::forward<Args>(args)...);
+        Sequence[Index(pos)].store(pos + 1, std::memory_order_release);
+        return true;
+    };
+
+    // Returns false if full
+    bool TryPush(const T& item)
+    {
+        return TryEmplace(item);
+    };
+
+    // Pushes as many items of [first, last) as there are free slots, as one
+    // run (no other producer's items in between), returns how many.
+    template <std::forward_iterator It>
+    size_t PushRange(It first, It last)
+    {
+        size_t n = static_cast<size_t>(std::distance(first, last));
+        if (n > Capacity) n = Capacity;
+        uint64_t pos;
+        n = Claim(n, pos);
+
+        T *out = &Slots.Data[Index(pos)];
+        if constexpr (std::contiguous_iterator<It>)
+        {
+            BulkCopy(out, std::to_address(first), n * sizeof(T));
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i, ++first) out[i] = *first;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            Sequence[Index(pos + i)].store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    };
+
+    template <std::ranges::forward_range R>
+        requires std::ranges::common_range<R>
+    size_t PushRange(R&& range)
+    {
+        return PushRange(std::ranges::begin(range), std::ranges::end(range));
+    };
+
+    // Consumer only. Up to `n` ready items at tail, oldest first, contiguous.
+    // Stops at the first slot claimed but not written yet. Empty if none.
+    std::span<T> FrontSpan(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        if (n > Capacity) n = Capacity;
+        size_t ready = 0;
+        while (ready < n && Sequence[Index(tail + ready)].load(std::memory_order_acquire) == tail + ready + 1)
+        {
+            ++ready;
+        }
+        return std::span<T>(&Slots.Data[Index(tail)], ready);
+    };
+
+    // Consumer only. Releases the first `n` items, at most FrontSpan() returned
+    void Pop(size_t n)
+    {
+        uint64_t tail = Tail.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Sequence[Index(tail + i)].store(tail + i + Capacity, std::memory_order_release);
+        }
+        Tail.store(tail + n, std::memory_order_release);
+    };
+
+    // Consumer only. Returns false (and leaves `item` untouched) if empty.
+    bool TryPop(T& item)
+    {
+        std::span<T> in = FrontSpan(1);
+        if (in.empty()) return false;
+        item = in[0];
+        Pop(1);
+        return true;
+    };
+
+private:
+    size_t Index(uint64_t pos) const
+    {
+        return (Capacity & (Capacity - 1)) == 0 ? pos & (Capacity - 1) : pos % Capacity;
+    };
+
+    // Claims up to `n` consecutive free positions at Head with one CAS,
+    // returns how many (0 if full) and the first one in `pos`.
+    size_t Claim(size_t n, uint64_t& pos)
+    {
+        pos = Head.load(std::memory_order_relaxed);
+        if (n == 0) return 0;
+        for (;;)
+        {
+            int64_t diff = 0;
+            size_t i = 0;
+            for (; i < n; ++i)
+            {
+                uint64_t seq = Sequence[Index(pos + i)].load(std::memory_order_acquire);
+                diff = static_cast<int64_t>(seq - (pos + i));
+                if (diff != 0) break;
+            }
+
+            if (i > 0)
+            {
+                // the free ones, unless someone moved Head (then `pos` is reloaded)
+                if (Head.compare_exchange_weak(pos, pos + i, std::memory_order_relaxed))
+                {
+                    return i;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the slot is still a lap behind: full
+                return 0;
+            }
+            else
+            {
+                // someone else claimed it already
+                pos = Head.load(std::memory_order_relaxed);
+            }
+        }
+    };
+};
+
+// One reader of a CBroadcastByteBuffer: its own Tail, on its own cache line,
+// next to what only that reader touches.
+struct alignas(CACHE_LINE_SIZE) CBroadcastCursor
+{
+    static constexpr uint64_t LAPPED = 1ull << 63; // Set in Tail by the producer (lossy rings)
+
+    std::atomic<uint64_t> Tail; // Bytes read: next pop, with LAPPED once overrun
+    uint64_t CachedHead;        // Last Head seen by this reader
+    size_t TailOffset;          // Tail % PSize
+    uint64_t Lost;              // Bytes skipped by Resync() since the last Reset()
+};
+
+// Single-producer/multi-consumer broadcast byte ring: every reader sees every
+// byte, from the same physical pages, zero copy (Peek/Consume), each at its own
+// pace. One ring and one copy of the data, instead of a CSpscByteBuffer (and a
+// copy) per reader.
+//
+// Every reader has its own Tail (CBroadcastCursor). The producer's free space
+// is bounded by the slowest one: like CSpscByteBuffer, it caches the smallest
+// Tail and only scans the cursors again when the cache says it is full.
+//
+// Lossy rings never hold the producer up: a reader too far behind for a push
+// is lapped (LAPPED set in its Tail, with a CAS) and left out of the free space.
+// Its Peek() is empty and its Consume() fails from then on, so bytes read
+// while being overwritten are never taken as good. Resync() skips it to Head.
+//
+// PSize: Physical buffer size, also the capacity in bytes.
+// VSize: Virtual buffer size, 2x PSize.
+class CBroadcastByteBuffer
+{
+public:
+    size_t PSize;    // Physical buffer size (multiple of your page size, probably 4096)
+    size_t VSize;    // Virtual buffer size, 2x PSize
+    size_t PageSize; // Page size backing the buffer (regular or huge)
+    std::byte *Data; // Buffer
+    size_t Readers;  // Cursors, one per reader
+    bool Lossy;      // Lap slow readers instead of waiting for them
+
+    // Producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> Head; // Bytes pushed: next push
+    uint64_t CachedMinTail;                              // Slowest Tail the producer saw
+    size_t HeadOffset;                                   // Head % PSize
+
+    // Reader side, one cache line each
+    std::unique_ptr<CBroadcastCursor[]> Cursors;
+
+    // Ring of `pbuffer_size_` bytes (rounded up to pages) for `readers_` readers
+    CBroadcastByteBuffer(size_t pbuffer_size_,
+                         size_t readers_,
+                         bool lossy_ = false,
+                         const CBufferOptions &options_ = CBufferOptions()) : PSize(ToNextPageSize(pbuffer_size_)),
+                                                                              VSize(2*PSize),
+                                                                              Readers(readers_),
+                                                                              Lossy(lossy_),
+                                                                              Cursors(new CBroadcastCursor[readers_])
+    {
+        if (Readers == 0)
+        {
+            throw std::invalid_argument("CBroadcastByteBuffer: needs at least one reader");
+        }
+        Data = static_cast<std::byte*>(AllocateMirror(PSize, VSize, PageSize, "CBroadcastByteBuffer", options_));
+        Reset();
+    };
+
+    ~CBroadcastByteBuffer()
+    {
+        if (Data != nullptr)
+        {
+            if (munmap(Data, VSize) == -1)
+            {
+                const char *error_msg = strerror(errno);
+                fprintf(stderr, "CBroadcastByteBuffer Cleanup Error: %s\n", error_msg);
+            }
+            Data = nullptr;
+        }
+    };
+
+    CBroadcastByteBuffer(const CBroadcastByteBuffer &) = delete;
+    CBroadcastByteBuffer &operator=(const CBroadcastByteBuffer &) = delete;
+
+    // Not thread safe: no one may be pushing or popping
+    void Reset()
+    {
+        Head.store(0, std::memory_order_relaxed);
+        CachedMinTail = 0;
+        HeadOffset = 0;
+        for (size_t r = 0; r < Readers; ++r)
+        {
+            Cursors[r].Tail.store(0, std::memory_order_relaxed);
+            Cursors[r].CachedHead = 0;
+            Cursors[r].TailOffset = 0;
+            Cursors[r].Lost = 0;
+        }
+    };
+
+    // Producer only. Contiguous `n` free bytes at head, to be written in place
+    // and published with Commit(). Empty if the slowest reader has not freed
+    // `n` bytes yet (never for lossy rings, which lap it).
+    // `n` must be at most PSize.
+    std::span<std::byte> Reserve(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        if (PSize - (head - CachedMinTail) < n)
+        {
+            CachedMinTail = MinTail(head, n);
+            if (PSize - (head - CachedMinTail) < n)
+            {
+                return std::span<std::byte>();
+            }
+        }
+        return std::span<std::byte>(&Data[HeadOffset], n);
+    };
+
+    // Producer only. Publishes `n` bytes written through Reserve() to every reader
+    void Commit(size_t n)
+    {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        HeadOffset += n;
+        if (HeadOffset >= PSize) HeadOffset -= PSize;
+        Head.store(head + n, std::memory_order_release);
+    };
+
+    // Producer only. Returns false (and pushes nothing) if `data` does not fit.
+    template <typename T>
+    bool TryPush(const T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::span<std::byte> out = Reserve(sizeof(T));
+        if (out.empty()) return false;
+        std::memcpy(out.data(), &data, sizeof(T));
+        Commit(sizeof(T));
+        return true;
+    };
+
+    // Reader `reader` only. Bytes ready to pop, 0 once lapped.
+    size_t GetPoppable(size_t reader) const
+    {
+        uint64_t tail = Cursors[reader].Tail.load(std::memory_order_relaxed);
+        if (tail & CBroadcastCursor::LAPPED) return 0;
+        return Head.load(std::memory_order_acquire) - tail;
+    };
+
+    // Reader `reader` only. Whether the producer lapped it (lossy rings)
+    bool IsLapped(size_t reader) const
+    {
+        return Cursors[reader].Tail.load(std::memory_order_relaxed) & CBroadcastCursor::LAPPED;
+    };
+
+    // Reader `reader` only. Contiguous `n` ready bytes at its tail, to be read
+    // in place and released with Consume(). Empty if `n` bytes are not ready,
+    // or if it was lapped.
+    std::span<const std::byte> Peek(size_t reader, size_t n)
+    {
+        CBroadcastCursor &cursor = Cursors[reader];
+        uint64_t tail = cursor.Tail.load(std::memory_order_relaxed);
+        if (tail & CBroadcastCursor::LAPPED) return std::span<const std::byte>();
+        if (cursor.CachedHead - tail < n)
+        {
+            cursor.CachedHead = Head.load(std::memory_order_acquire);
+            if (cursor.CachedHead - tail < n)
+            {
+                return std::span<const std::byte>();
+            }
+        }
+        return std::span<const std::byte>(&Data[cursor.TailOffset], n);
+    };
+
+    // Reader `reader` only. Releases `n` bytes read through Peek(). On lossy
+    // rings, returns false if the reader was lapped meanwhile: the bytes read
+    // may have been overwritten, drop them and Resync().
+    bool Consume(size_t reader, size_t n)
+    {
+        CBroadcastCursor &cursor = Cursors[reader];
+        uint64_t tail = cursor.Tail.load(std::memory_order_relaxed) & ~CBroadcastCursor::LAPPED;
+        if (Lossy)
+        {
+            // release: our reads of the bytes come before the producer can take them
+            if (!cursor.Tail.compare_exchange_strong(tail, tail + n, std::memory_order_acq_rel,
+                                                     std::memory_order_relaxed))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            cursor.Tail.store(tail + n, std::memory_order_release);
+        }
+        cursor.TailOffset += n;
+        if (cursor.TailOffset >= PSize) cursor.TailOffset -= PSize;
+        return true;
+    };
+
+    // Reader `reader` only. Returns false (and leaves `data` untouched) if
+    // there is no complete T to pop, or if it was lapped.
+    template <typename T>
+    bool TryPop(size_t reader, T& data) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::span<const std::byte> in = Peek(reader, sizeof(T));
+        if (in.empty()) return false;
+        T item;
+        std::memcpy(&item, in.data(), sizeof(T));
+        if (!Consume(reader, sizeof(T))) return false;
+        data = item;
+        return true;
+    };
+
+    // Reader `reader` only. Skips a lapped reader to Head, where the producer
+    // counts it again. Returns the bytes skipped (also added to Lost), 0 if it
+    // was not lapped.
+    size_t Resync(size_t reader)
+    {
+        CBroadcastCursor &cursor = Cursors[reader];
+        uint64_t tail = cursor.Tail.load(std::memory_order_acquire);
+        if (!(tail & CBroadcastCursor::LAPPED)) return 0;
+
+        // no longer LAPPED: the producer leaves these bytes alone from its next scan on.
+        // It is past Head already, so what it writes meanwhile is beyond them.
+        uint64_t head = Head.load(std::memory_order_acquire);
+        cursor.Tail.store(head, std::memory_order_release);
+        cursor.CachedHead = head;
+        cursor.TailOffset = head % PSize;
+        size_t lost = head - (tail & ~CBroadcastCursor::LAPPED);
+        cursor.Lost += lost;
+        return lost;
+    };
+
+private:
+    // Slowest Tail of the readers not lapped, Head if there are none. Lossy
+    // rings lap the readers that would leave fewer than `n` bytes free.
+    uint64_t MinTail(uint64_t head, size_t n)
+    {
+        uint64_t min = head;
+        for (size_t r = 0; r < Readers; ++r)
+        {
+            std::atomic<uint64_t> &cursor_tail = Cursors[r].Tail;
+            uint64_t tail = cursor_tail.load(std::memory_order_acquire);
+            while (!(tail & CBroadcastCursor::LAPPED))
+            {
+                if (Lossy && PSize - (head - tail) < n)
+                {
+                    // fails if the reader moved meanwhile: check it again
+                    if (cursor_tail.compare_exchange_weak(tail, tail | CBroadcastCursor::LAPPED,
+                                                          std::memory_order_acq_rel, std::memory_order_acquire)) break;
+                    continue;
+                }
+                if (tail < min) min = tail;
+                break;
+            }
+        }
+        return min;
+    };
+};
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef C_URING_HPP
+#define C_URING_HPP
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "cqueue.hpp"
+
+// Asynchronous reads from a file or a socket into a CSpscByteBuffer, with io_uring.
+//
+// Up to `Depth` reads are in flight at once, each one into the next `Chunk`
+// bytes reserved past Head (Reserve()), and completions commit (Commit())
+// in order, whatever order the kernel finishes them in. The consumer sees a plain
+// byte stream through Peek/Consume, from another thread if it likes.
+// A whole batch of reads costs one io_uring_enter, completions are read from the
+// shared completion ring: no syscall per read.
+//
+// The mirrored region (both views) is registered as one fixed buffer, so the kernel
+// does not map and pin the pages on every read. Falls back to plain reads if it
+// cannot be registered (RLIMIT_MEMLOCK).
+//
+// Files (an `offset`): reads run in parallel, at consecutive offsets.
+// Streams (sockets, pipes, no `offset`): reads are linked, so they run in order,
+// and a short read cancels the rest of the batch.
+// Either way, what was read after a short read is dropped, and reading starts
+// again right after it once all reads are back: the stream never has gaps.
+class CUringReader
+{
+public:
+    CSpscByteBuffer &Buffer; // Where reads go, this is its producer
+    int Fd;                  // File or socket read from
+    size_t Chunk;            // Bytes per read
+    unsigned Depth;          // Max reads in flight
+    off_t Offset;            // File offset of the next read, -1 for streams
+    bool Fixed;              // The buffer is registered (READ_FIXED)
+    bool Eof;                // A read returned 0: nothing more to queue
+    int Error;               // errno of the first failed read, 0 if none
+
+    // Reads from `fd_` into `buffer_`, `chunk_` bytes at a time (at most PSize),
+    // `depth_` reads in flight. From file offset `offset_`, or -1 for a stream.
+    CUringReader(CSpscByteBuffer &buffer_,
+                 int fd_,
+                 size_t chunk_,
+                 unsigned depth_ = 8,
+                 off_t offset_ = -1) : Buffer(buffer_),
+                                       Fd(fd_),
+                                       Chunk(chunk_ < buffer_.PSize ? chunk_ : buffer_.PSize),
+                                       Depth(depth_ ? depth_ : 1),
+                                       Offset(offset_),
+                                       Fixed(false),
+                                       Eof(false),
+                                       Error(0),
+                                       Reads(new Read[Depth]),
+                                       Queued(0),
+                                       Completed(0),
+                                       NextPos(buffer_.Head.load(std::memory_order_relaxed)),
+                                       Dropping(false)
+    {
+        Setup();
+
+        struct iovec iov = {Buffer.Data, Buffer.VSize};
+        Fixed = syscall(__NR_io_uring_register, RingFd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    };
+
+    // Reads still in flight are cancelled with the ring
+    ~CUringReader()
+    {
+        if (Sqes != nullptr) munmap(Sqes, SqesSize);
+        if (CqRing != nullptr && CqRing != SqRing) munmap(CqRing, CqRingSize);
+        if (SqRing != nullptr) munmap(SqRing, SqRingSize);
+        if (RingFd != -1) close(RingFd);
+    };
+
+    CUringReader(const CUringReader &) = delete;
+    CUringReader &operator=(const CUringReader &) = delete;
+
+    // Reads submitted and not committed yet
+    unsigned GetInFlight() const
+    {
+        return static_cast<unsigned>(Queued - Completed);
+    };
+
+    // Queues as many reads as fit (Depth, free space in the buffer), submits
+    // them with one io_uring_enter, then commits the completed ones, in order.
+    // With `wait`, blocks in the same io_uring_enter until at least one read
+    // is back, if any is in flight.
+    // Returns the bytes committed, Eof and Error tell why it stops.
+    size_t Poll(bool wait = false)
+    {
+        unsigned queued = Queue();
+        bool ready = CqReady() != 0;
+        unsigned wait_nr = wait && !ready && GetInFlight() ? 1 : 0;
+        if (queued || wait_nr)
+        {
+            int ret;
+            do
+            {
+                ret = syscall(__NR_io_uring_enter, RingFd, queued, wait_nr,
+                              wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            } while (ret == -1 && errno == EINTR);
+            if (ret == -1)
+            {
+                throw std::runtime_error("io_uring_enter failed");
+            }
+        }
+        return Reap();
+    };
+
+private:
+    struct Read
+    {
+        off_t Offset;   // File offset read from, -1 for streams
+        int32_t Result; // Bytes read, 0 for end of file, -errno
+        bool Done;      // Completion seen
+    };
+
+    std::unique_ptr<Read[]> Reads; // In flight reads, by sequence % Depth
+    uint64_t Queued;               // Reads submitted
+    uint64_t Completed;            // Reads committed
+    uint64_t NextPos;              // Where the next read goes, in bytes pushed (like Head)
+    bool Dropping;                 // After a short read: drop the rest of the reads in flight
+
+    int RingFd = -1;
+    void *SqRing = nullptr;
+    void *CqRing = nullptr;
+    io_uring_sqe *Sqes = nullptr;
+    size_t SqRingSize = 0;
+    size_t CqRingSize = 0;
+    size_t SqesSize = 0;
+    unsigned *SqTail;
+    unsigned *SqMask;
+    unsigned *SqArray;
+    unsigned *CqHead;
+    unsigned *CqTail;
+    unsigned *CqMask;
+    io_uring_cqe *Cqes;
+
+    void Setup()
+    {
+        io_uring_params params = {};
+        RingFd = syscall(__NR_io_uring_setup, Depth, &params);
+        if (RingFd == -1)
+        {
+            throw std::runtime_error("io_uring_setup failed");
+        }
+
+        SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single && CqRingSize > SqRingSize) SqRingSize = CqRingSize;
+        SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+        SqRing = mmap(NULL, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQ_RING);
+        CqRing = single ? SqRing : mmap(NULL, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_CQ_RING);
+        void *sqes = mmap(NULL, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQES);
+        if (SqRing == MAP_FAILED || CqRing == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            if (sqes != MAP_FAILED) munmap(sqes, SqesSize);
+            if (CqRing != MAP_FAILED && CqRing != SqRing) munmap(CqRing, CqRingSize);
+            if (SqRing != MAP_FAILED) munmap(SqRing, SqRingSize);
+            close(RingFd);
+            throw std::runtime_error("io_uring mapping failed");
+        }
+        Sqes = static_cast<io_uring_sqe *>(sqes);
+
+        char *sq = static_cast<char *>(SqRing);
+        char *cq = static_cast<char *>(CqRing);
+        SqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        SqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        SqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        CqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        CqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        CqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        Cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    };
+
+    unsigned CqReady() const
+    {
+        return std::atomic_ref<unsigned>(*CqTail).load(std::memory_order_acquire) - *CqHead;
+    };
+
+    // Fills submission entries, returns how many
+    unsigned Queue()
+    {
+        if (Eof || Error) return 0;
+        // a linked batch has to be back in full before the next one starts,
+        // and so do reads dropped after a short read
+        if ((Offset < 0 || Dropping) && GetInFlight()) return 0;
+
+        unsigned tail = *SqTail;
+        unsigned queued = 0;
+        io_uring_sqe *last = nullptr;
+        while (GetInFlight() < Depth)
+        {
+            uint64_t head = Buffer.Head.load(std::memory_order_relaxed);
+            size_t ahead = NextPos - head;
+            std::span<std::byte> out = Buffer.Reserve(ahead + Chunk);
+            if (out.empty()) break;
+
+            unsigned index = tail & *SqMask;
+            io_uring_sqe *sqe = &Sqes[index];
+            *sqe = {};
+            sqe->opcode = Fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe->fd = Fd;
+            sqe->addr = reinterpret_cast<uint64_t>(out.data() + ahead);
+            sqe->len = Chunk;
+            sqe->off = Offset < 0 ? static_cast<uint64_t>(-1) : static_cast<uint64_t>(Offset);
+            sqe->buf_index = 0;
+            sqe->flags = Offset < 0 ? IOSQE_IO_LINK : 0;
+            sqe->user_data = Queued;
+            SqArray[index] = index;
+            last = sqe;
+
+            Reads[Queued % Depth] = {Offset, 0, false};
+            ++Queued;
+            ++tail;
+            ++queued;
+            NextPos += Chunk;
+            if (Offset >= 0) Offset += Chunk;
+        }
+        if (last != nullptr) last->flags &= ~IOSQE_IO_LINK; // the chain ends with the batch
+        std::atomic_ref<unsigned>(*SqTail).store(tail, std::memory_order_release);
+        return queued;
+    };
+
+    // Marks completions, commits done reads in order, returns bytes committed
+    size_t Reap()
+    {
+        unsigned head = *CqHead;
+        unsigned tail = std::atomic_ref<unsigned>(*CqTail).load(std::memory_order_acquire);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe &cqe = Cqes[head & *CqMask];
+            Read &read = Reads[cqe.user_data % Depth];
+            read.Result = cqe.res;
+            read.Done = true;
+        }
+        std::atomic_ref<unsigned>(*CqHead).store(head, std::memory_order_release);
+
+        size_t committed = 0;
+        while (Completed != Queued && Reads[Completed % Depth].Done)
+        {
+            Read &read = Reads[Completed % Depth];
+            ++Completed;
+            if (Dropping) continue;
+
+            if (read.Result > 0)
+            {
+                // in order and no gaps: this read went right at Head
+                Buffer.Commit(read.Result);
+                committed += read.Result;
+                if (static_cast<size_t>(read.Result) < Chunk)
+                {
+                    Dropping = true;
+                    if (Offset >= 0) Offset = read.Offset + read.Result;
+                }
+            }
+            else if (read.Result == 0)
+            {
+                Eof = true;
+            }
+            else
+            {
+                // cancelled by a short read (streams), or a real error
+                Dropping = true;
+                if (read.Result != -ECANCELED && read.Result != -EINTR && read.Result != -EAGAIN && !Error)
+                {
+                    Error = -read.Result;
+                }
+                if (Offset >= 0) Offset = read.Offset;
+            }
+        }
+        // nothing in flight: the next reads start at Head
+        if (Completed == Queued)
+        {
+            NextPos = Buffer.Head.load(std::memory_order_relaxed);
+            Dropping = false;
+        }
+        return committed;
+    };
+};
+
+#endif
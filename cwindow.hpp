@@ -0,0 +1,287 @@
+#ifndef C_WINDOW_HPP
+#define C_WINDOW_HPP
+
+#include <span>
+
+#include "cbuffer.hpp"
+
+// Sliding window reductions over a CBuffer: sum, min, max and dot product of
+// the `n` items from `tail` onwards, straight over `Data + tail`. The mirror
+// makes every window of up to PItemCount items contiguous, so the kernels
+// never mask an index or split a window in two.
+//
+// Like BulkCopy, kernels use the widest vector unit the CPU has (AVX-512, AVX2,
+// SSE2 otherwise), picked once at startup. Sums and dot products accumulate in
+// T, over 4 vectors of lanes: floating point results differ from a sequential
+// loop by rounding only. Min and max of NaNs are unspecified.
+
+enum class WindowOp
+{
+    Sum,
+    Min,
+    Max,
+    Dot
+};
+
+template <typename T, size_t Bytes>
+struct WindowVector
+{
+    typedef T Type __attribute__((vector_size(Bytes)));
+};
+
+// Reduces x[0, n) (and w[0, n) for Dot) with vectors of `Bytes`.
+// Min and Max need n > 0. Inlined into the target specific kernels below.
+template <WindowOp Op, size_t Bytes, typename T>
+__attribute__((always_inline)) inline T WindowReduce(const T *x, const T *w, size_t n)
+{
+    using V = typename WindowVector<T, Bytes>::Type;
+    constexpr size_t LANES = Bytes / sizeof(T);
+
+    // by reference: vectors wider than the baseline ISA must not be passed by value
+    auto combine = [](V &acc, const V &v) {
+        if constexpr (Op == WindowOp::Min) acc = acc < v ? acc : v;
+        else if constexpr (Op == WindowOp::Max) acc = acc > v ? acc : v;
+        else acc += v;
+    };
+    auto fold = [&](V &acc, size_t i) {
+        V v;
+        std::memcpy(&v, &x[i], sizeof(V));
+        if constexpr (Op == WindowOp::Dot)
+        {
+            V u;
+            std::memcpy(&u, &w[i], sizeof(V));
+            v *= u;
+        }
+        combine(acc, v);
+    };
+
+    T init = Op == WindowOp::Min || Op == WindowOp::Max ? x[0] : T(0);
+    V splat = V{} + init;
+    V acc[4] = {splat, splat, splat, splat};
+
+    size_t i = 0;
+    for (; i + 4*LANES <= n; i += 4*LANES)
+    {
+        fold(acc[0], i);
+        fold(acc[1], i + LANES);
+        fold(acc[2], i + 2*LANES);
+        fold(acc[3], i + 3*LANES);
+    }
+    for (; i + LANES <= n; i += LANES)
+    {
+        fold(acc[0], i);
+    }
+    combine(acc[0], acc[1]);
+    combine(acc[2], acc[3]);
+    combine(acc[0], acc[2]);
+
+    T result = acc[0][0];
+    for (size_t l = 1; l < LANES; ++l)
+    {
+        if constexpr (Op == WindowOp::Min) result = acc[0][l] < result ? acc[0][l] : result;
+        else if constexpr (Op == WindowOp::Max) result = acc[0][l] > result ? acc[0][l] : result;
+        else result += acc[0][l];
+    }
+    for (; i < n; ++i)
+    {
+        if constexpr (Op == WindowOp::Min) result = x[i] < result ? x[i] : result;
+        else if constexpr (Op == WindowOp::Max) result = x[i] > result ? x[i] : result;
+        else if constexpr (Op == WindowOp::Dot) result += x[i] * w[i];
+        else result += x[i];
+    }
+    return result;
+}
+
+template <WindowOp Op, typename T>
+__attribute__((target("avx512f,avx512bw,avx512dq")))
+T WindowReduceAvx512(const T *x, const T *w, size_t n)
+{
+    return WindowReduce<Op, 64>(x, w, n);
+}
+
+template <WindowOp Op, typename T>
+__attribute__((target("avx2")))
+T WindowReduceAvx2(const T *x, const T *w, size_t n)
+{
+    return WindowReduce<Op, 32>(x, w, n);
+}
+
+template <WindowOp Op, typename T>
+T WindowReduceSse2(const T *x, const T *w, size_t n)
+{
+    return WindowReduce<Op, 16>(x, w, n);
+}
+
+// CPU dispatch, resolved on first use (per op and type)
+template <WindowOp Op, typename T>
+inline auto GetWindowKernel()
+{
+    using Kernel = T (*)(const T *, const T *, size_t);
+    static const Kernel kernel = []() -> Kernel {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("avx512dq")) return WindowReduceAvx512<Op, T>;
+        if (__builtin_cpu_supports("avx2")) return WindowReduceAvx2<Op, T>;
+        return WindowReduceSse2<Op, T>;
+    }();
+    return kernel;
+}
+
+// First item of the window from `tail`: any index, taken modulo the physical
+// item count, so a running count of items pushed works too.
+// `n` items from there must fit in the virtual buffer: at most PItemCount,
+// which any mirror has room for, MirrorMode::Double (two views) included.
+template <typename T>
+inline const T *WindowData(const CBuffer<T> &buffer, size_t tail, size_t n)
+{
+    size_t start = tail % buffer.GetPItemCount();
+    assert(start + n <= buffer.GetVItemCount());
+    return &buffer.Data[start];
+}
+
+// Sum of the `n` items from `tail`, 0 if `n` is 0
+template <typename T>
+inline T WindowSum(const CBuffer<T> &buffer, size_t tail, size_t n)
+{
+    static_assert(std::is_arithmetic_v<T>, "Window reductions need an arithmetic type.");
+    return n ? GetWindowKernel<WindowOp::Sum, T>()(WindowData(buffer, tail, n), nullptr, n) : T(0);
+}
+
+// Smallest of the `n` items from `tail`, `n` must not be 0
+template <typename T>
+inline T WindowMin(const CBuffer<T> &buffer, size_t tail, size_t n)
+{
+    static_assert(std::is_arithmetic_v<T>, "Window reductions need an arithmetic type.");
+    assert(n > 0);
+    return GetWindowKernel<WindowOp::Min, T>()(WindowData(buffer, tail, n), nullptr, n);
+}
+
+// Largest of the `n` items from `tail`, `n` must not be 0
+template <typename T>
+inline T WindowMax(const CBuffer<T> &buffer, size_t tail, size_t n)
+{
+    static_assert(std::is_arithmetic_v<T>, "Window reductions need an arithmetic type.");
+    assert(n > 0);
+    return GetWindowKernel<WindowOp::Max, T>()(WindowData(buffer, tail, n), nullptr, n);
+}
+
+// Dot product of the `n` items from `tail` with `weights[0, n)`, oldest item
+// first (a FIR filter over the window), 0 if `n` is 0
+template <typename T>
+inline T WindowDot(const CBuffer<T> &buffer, size_t tail, const T *weights, size_t n)
+{
+    static_assert(std::is_arithmetic_v<T>, "Window reductions need an arithmetic type.");
+    return n ? GetWindowKernel<WindowOp::Dot, T>()(WindowData(buffer, tail, n), weights, n) : T(0);
+}
+
+// The last `Length` samples of a stream, with a running sum: Push() adds the
+// new sample and subtracts the one it evicts, O(1) per sample. Min, Max and
+// Dot run the vector kernels over the window, which is always contiguous.
+//
+// Floating point running sums drift, so every `Length` pushes the sum is
+// recomputed with WindowSum: still O(1) per sample, amortized.
+template <typename T>
+class CRollingWindow
+{
+    static_assert(std::is_arithmetic_v<T>, "CRollingWindow needs an arithmetic type.");
+
+public:
+    CBuffer<T> Buffer; // Samples, mirrored twice
+    size_t Length;     // Window length, in samples
+    uint64_t Head;     // Samples pushed
+
+    // Window of `length_` samples. The buffer is rounded up to pages, so it
+    // holds at least that many.
+    CRollingWindow(size_t length_,
+                   const CBufferOptions &options_ = CBufferOptions()) : Buffer(length_ * sizeof(T), 2, options_),
+                                                                        Length(length_),
+                                                                        Head(0),
+                                                                        RunningSum(0),
+                                                                        SinceSync(0)
+    {
+        if (Length == 0 || Buffer.GetPageCount() < 2)
+        {
+            throw std::invalid_argument("CRollingWindow: needs a length and a mirrored buffer");
+        }
+    };
+
+    CRollingWindow(const CRollingWindow &) = delete;
+    CRollingWindow &operator=(const CRollingWindow &) = delete;
+
+    void Reset()
+    {
+        Head = 0;
+        RunningSum = 0;
+        SinceSync = 0;
+    };
+
+    // Samples in the window: Length once that many were pushed
+    size_t GetSize() const
+    {
+        return Head < Length ? Head : Length;
+    };
+
+    void Push(T sample)
+    {
+        size_t count = Buffer.GetPItemCount();
+        // read the evicted sample first: with Length == count it sits in the
+        // slot the new one goes to
+        if (Head >= Length)
+        {
+            RunningSum -= Buffer.Data[(Head - Length) % count];
+        }
+        Buffer.Data[Head % count] = sample;
+        RunningSum += sample;
+        ++Head;
+
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (++SinceSync == Length)
+            {
+                RunningSum = WindowSum(Buffer, Head - GetSize(), GetSize());
+                SinceSync = 0;
+            }
+        }
+    };
+
+    // The window, oldest sample first
+    std::span<const T> Window() const
+    {
+        return std::span<const T>(WindowData(Buffer, Head - GetSize(), GetSize()), GetSize());
+    };
+
+    T Sum() const
+    {
+        return RunningSum;
+    };
+
+    // 0 if the window is empty
+    double Mean() const
+    {
+        return GetSize() ? static_cast<double>(RunningSum) / GetSize() : 0.0;
+    };
+
+    // The window must not be empty
+    T Min() const
+    {
+        return WindowMin(Buffer, Head - GetSize(), GetSize());
+    };
+
+    // The window must not be empty
+    T Max() const
+    {
+        return WindowMax(Buffer, Head - GetSize(), GetSize());
+    };
+
+    // Dot product of the window with `weights[0, GetSize())`, oldest sample first
+    T Dot(const T *weights) const
+    {
+        return WindowDot(Buffer, Head - GetSize(), weights, GetSize());
+    };
+
+private:
+    T RunningSum;     // Sum of the window
+    size_t SinceSync; // Pushes since RunningSum was recomputed
+};
+
+#endif